@@ -1,14 +1,55 @@
 #ifndef THE_PICKAXE_HPP
 #define THE_PICKAXE_HPP
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
+#include <cstring>
+#include <deque>
 #include <exception>
+#include <filesystem>
+#include <map>
+#include <memory_resource>
+#include <mutex>
+#include <span>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <type_traits>
+#include <utility>
 #include <vector>
 
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define PICKAXE_POSIX 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define PICKAXE_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+
 namespace pickaxe {
 
   class Exception : public std::exception {
@@ -89,14 +130,519 @@ namespace pickaxe {
     }
   };
 
+  inline constexpr uint64_t max_varint_size = 10;
+
+  // Encodes value as LEB128: seven bits per byte, low bits first, with the
+  // high bit of each byte set when more bytes follow. Returns the number of
+  // bytes used.
+  inline uint64_t encode_varint(
+    uint64_t value,
+    uint8_t *bytes)
+  {
+    uint64_t size = 0;
+    while (value >= 0x80) {
+      bytes[size++] = static_cast<uint8_t>(value | 0x80);
+      value >>= 7;
+    }
+    bytes[size++] = static_cast<uint8_t>(value);
+    return size;
+  }
+
+#if defined(PICKAXE_POSIX)
+  // The most buffers a readv or writev call accepts on Linux and macOS
+  // (IOV_MAX); longer lists are transferred in several calls.
+  inline constexpr uint64_t max_iovecs = 1024;
+
+  // Advances past the first size bytes of count buffers, after a readv or
+  // writev call that transferred only that many.
+  inline void advance_iovecs(
+    iovec *&vectors,
+    uint64_t &count,
+    uint64_t size)
+  {
+    while (count != 0 && size >= vectors->iov_len) {
+      size -= vectors->iov_len;
+      ++vectors;
+      --count;
+    }
+    if (count != 0) {
+      vectors->iov_base = static_cast<std::byte *>(vectors->iov_base) + size;
+      vectors->iov_len -= size;
+    }
+  }
+#endif
+
+  // Container encodings shared by Serializer and MemorySerializer. Each
+  // writes a varint count followed by the elements.
+
+  // Writes a string, to be read with Deserializer::read_string().
+  template <typename Writer>
+  void encode_string(
+    Writer &writer,
+    std::string_view value)
+  {
+    writer.write_varint(value.size());
+    if (!value.empty()) {
+      writer.write(value.data(), value.size());
+    }
+  }
+
+  // Writes a contiguous range of POD values, to be read with
+  // Deserializer::read_vector().
+  template <typename Writer, typename Range>
+  void encode_vector(
+    Writer &writer,
+    Range const &values)
+  {
+    auto span = std::span(values);
+    static_assert(std::is_pod_v<typename decltype(span)::value_type>);
+    writer.write_varint(span.size());
+    if (!span.empty()) {
+      writer.write(span.data(), span.size_bytes());
+    }
+  }
+
+  // Writes a map whose keys and values are POD values or strings, to be
+  // read with Deserializer::read_map().
+  template <typename Writer, typename Map>
+  void encode_map(
+    Writer &writer,
+    Map const &map)
+  {
+    auto encode_element = [&writer](auto const &element) {
+      using Element = std::remove_cvref_t<decltype(element)>;
+      if constexpr (std::is_convertible_v<Element const &, std::string_view>) {
+        encode_string(writer, element);
+      }
+      else {
+        static_assert(std::is_pod_v<Element>);
+        writer.write(element);
+      }
+    };
+    writer.write_varint(map.size());
+    for (auto const &[key, value] : map) {
+      encode_element(key);
+      encode_element(value);
+    }
+  }
+
+  // Uninitialized memory for page buffers, aligned to the system page. With
+  // huge_pages, buffers of at least a huge page are backed by 2 MiB huge
+  // pages where possible, to cut TLB misses when copying out of multi-MiB
+  // pages: reserved huge pages (MAP_HUGETLB) first, then transparent huge
+  // pages (MADV_HUGEPAGE), and otherwise normal pages.
+  class PageBuffer {
+    static constexpr uint64_t _alignment = 4096;
+
+    std::byte *_data;
+    uint64_t _size;
+    uint64_t _mapped_size;
+    bool _is_huge;
+
+  public:
+    static constexpr uint64_t huge_page_size = 2 * 1024 * 1024;
+
+    ~PageBuffer() noexcept
+    {
+      _free();
+    }
+
+    PageBuffer() noexcept
+      : _data(nullptr)
+      , _size(0)
+      , _mapped_size(0)
+      , _is_huge(false)
+    {}
+
+    explicit PageBuffer(
+      uint64_t size,
+      bool huge_pages = false)
+      : PageBuffer()
+    {
+      _size = size;
+#if defined(PICKAXE_POSIX) && defined(MAP_ANONYMOUS)
+      if (huge_pages && size >= huge_page_size) {
+        _map_huge();
+        if (_data != nullptr) {
+          return;
+        }
+      }
+#else
+      (void)huge_pages;
+#endif
+      _data = static_cast<std::byte *>(::operator new(size, std::align_val_t(_alignment)));
+    }
+
+    PageBuffer(
+      PageBuffer &&other) noexcept
+      : _data(std::exchange(other._data, nullptr))
+      , _size(std::exchange(other._size, 0))
+      , _mapped_size(std::exchange(other._mapped_size, 0))
+      , _is_huge(std::exchange(other._is_huge, false))
+    {}
+
+    PageBuffer(PageBuffer const &) = delete;
+
+    PageBuffer &operator=(
+      PageBuffer &&other) noexcept
+    {
+      _free();
+      _data = std::exchange(other._data, nullptr);
+      _size = std::exchange(other._size, 0);
+      _mapped_size = std::exchange(other._mapped_size, 0);
+      _is_huge = std::exchange(other._is_huge, false);
+      return *this;
+    }
+
+    PageBuffer &operator=(PageBuffer const &) = delete;
+
+    [[nodiscard]] std::byte *get_data() const
+    {
+      return _data;
+    }
+
+    [[nodiscard]] uint64_t get_size() const
+    {
+      return _size;
+    }
+
+    // Whether the buffer is backed by huge pages, as far as can be told:
+    // transparent huge pages are only advised, and the kernel may still
+    // use normal pages for some of the buffer.
+    [[nodiscard]] bool is_huge() const
+    {
+      return _is_huge;
+    }
+
+  private:
+#if defined(PICKAXE_POSIX) && defined(MAP_ANONYMOUS)
+    void _map_huge()
+    {
+      auto size = (_size + huge_page_size - 1) / huge_page_size * huge_page_size;
+#if defined(MAP_HUGETLB)
+      auto *data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      if (data != MAP_FAILED) {
+        _data = static_cast<std::byte *>(data);
+        _mapped_size = size;
+        _is_huge = true;
+        return;
+      }
+#endif
+#if defined(MADV_HUGEPAGE)
+      // Transparent huge pages need 2 MiB aligned ranges, so map one huge
+      // page more than needed and trim both ends.
+      auto *mapping = ::mmap(nullptr, size + huge_page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (mapping == MAP_FAILED) {
+        return;
+      }
+      auto begin = reinterpret_cast<uintptr_t>(mapping);
+      auto aligned = (begin + huge_page_size - 1) / huge_page_size * huge_page_size;
+      if (aligned != begin) {
+        ::munmap(mapping, aligned - begin);
+      }
+      if (aligned + size != begin + size + huge_page_size) {
+        ::munmap(reinterpret_cast<void *>(aligned + size), begin + huge_page_size - aligned);
+      }
+      _data = reinterpret_cast<std::byte *>(aligned);
+      _mapped_size = size;
+      _is_huge = ::madvise(_data, size, MADV_HUGEPAGE) == 0;
+#endif
+    }
+#endif
+
+    void _free()
+    {
+      if (_data == nullptr) {
+        return;
+      }
+#if defined(PICKAXE_POSIX) && defined(MAP_ANONYMOUS)
+      if (_mapped_size != 0) {
+        ::munmap(_data, _mapped_size);
+        _data = nullptr;
+        return;
+      }
+#endif
+      ::operator delete(_data, std::align_val_t(_alignment));
+      _data = nullptr;
+    }
+  };
+
+  // A thread-safe pool of PageBuffers, so that short-lived Deserializers and
+  // buffered Serializers reuse buffers instead of allocating a fresh one
+  // each. It is the user's responsibility to make sure the pool outlives
+  // every Serializer or Deserializer that borrows from it.
+  class PageBufferPool {
+    std::mutex _mutex;
+    std::vector<PageBuffer> _free;
+    uint64_t _max_free_count;
+    bool _huge_pages;
+
+  public:
+    // At most max_free_count returned buffers are kept; any more are freed.
+    explicit PageBufferPool(
+      uint64_t max_free_count = 64,
+      bool huge_pages = false)
+      : _max_free_count(max_free_count)
+      , _huge_pages(huge_pages)
+    {}
+
+    PageBufferPool(PageBufferPool const &) = delete;
+    PageBufferPool &operator=(PageBufferPool const &) = delete;
+
+    [[nodiscard]] uint64_t get_free_count()
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      return _free.size();
+    }
+
+    // Returns the smallest free buffer of at least size bytes, or a new one
+    // if there is none. Its contents are unspecified.
+    [[nodiscard]] PageBuffer acquire(
+      uint64_t size)
+    {
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto best = _free.end();
+        for (auto it = _free.begin(); it != _free.end(); ++it) {
+          if (it->get_size() >= size && (best == _free.end() || it->get_size() < best->get_size())) {
+            best = it;
+          }
+        }
+        if (best != _free.end()) {
+          auto buffer = std::move(*best);
+          *best = std::move(_free.back());
+          _free.pop_back();
+          return buffer;
+        }
+      }
+      return PageBuffer(size, _huge_pages);
+    }
+
+    void release(
+      PageBuffer buffer)
+    {
+      if (buffer.get_data() == nullptr) {
+        return;
+      }
+      std::lock_guard<std::mutex> lock(_mutex);
+      if (_free.size() < _max_free_count) {
+        _free.push_back(std::move(buffer));
+      }
+    }
+  };
+
+  // Serializes a section into memory, with the same writing interface as
+  // Serializer, so independent sections can be built on separate threads
+  // and then spliced into a file in order with Serializer::splice().
+  // Offsets inside the section are relative to its start.
+  class MemorySerializer {
+    std::vector<std::byte> _buffer;
+    uint64_t _offset;
+    uint64_t _alignment;
+    std::vector<uint64_t> _relocations;
+
+  public:
+    MemorySerializer()
+      : _offset(0)
+      , _alignment(1)
+    {}
+
+    // Bytes that were skipped over rather than written are zero.
+    [[nodiscard]] std::byte const *get_data() const
+    {
+      return _buffer.data();
+    }
+
+    [[nodiscard]] uint64_t get_size() const
+    {
+      return _buffer.size();
+    }
+
+    // Largest alignment used so far; the section is spliced at a multiple
+    // of it.
+    [[nodiscard]] uint64_t get_alignment() const
+    {
+      return _alignment;
+    }
+
+    [[nodiscard]] std::vector<uint64_t> const &get_relocations() const
+    {
+      return _relocations;
+    }
+
+    [[nodiscard]] uint64_t get_offset() const
+    {
+      return _offset;
+    }
+
+    void set_offset(
+      uint64_t new_offset)
+    {
+      _offset = new_offset;
+    }
+
+    void set_offset_aligned(
+      uint64_t new_offset,
+      uint64_t alignment)
+    {
+      _alignment = std::max(_alignment, alignment);
+      set_offset((new_offset + alignment - 1) / alignment * alignment);
+    }
+
+    void skip(
+      uint64_t size)
+    {
+      _offset += size;
+      _grow(_offset);
+    }
+
+    template <typename T>
+    void write(
+      T const &data)
+    {
+      static_assert(std::is_pod_v<T>);
+      write(&data, sizeof(T));
+    }
+
+    template <typename T>
+    void write_aligned(
+      T const &data)
+    {
+      static_assert(std::is_pod_v<T>);
+      write_aligned(&data, sizeof(T), alignof(T));
+    }
+
+    void write(
+      void const *data,
+      uint64_t size)
+    {
+      _grow(_offset + size);
+      if (size != 0) {
+        std::memcpy(_buffer.data() + _offset, data, size);
+      }
+      _offset += size;
+    }
+
+    void write_aligned(
+      void const *data,
+      uint64_t size,
+      uint64_t alignment)
+    {
+      set_offset_aligned(_offset, alignment);
+      write(data, size);
+    }
+
+    void write_varint(
+      uint64_t value)
+    {
+      uint8_t bytes[max_varint_size];
+      write(bytes, encode_varint(value, bytes));
+    }
+
+    void write_string(
+      std::string_view value)
+    {
+      encode_string(*this, value);
+    }
+
+    template <typename Range>
+    void write_vector(
+      Range const &values)
+    {
+      encode_vector(*this, values);
+    }
+
+    template <typename Map>
+    void write_map(
+      Map const &map)
+    {
+      encode_map(*this, map);
+    }
+
+    // Writes a uint64_t offset relative to the start of the section, which
+    // Serializer::splice() turns into an offset into the file.
+    void write_offset(
+      uint64_t section_offset)
+    {
+      _relocations.push_back(_offset);
+      write(section_offset);
+    }
+
+  private:
+    void _grow(
+      uint64_t size)
+    {
+      if (_buffer.size() < size) {
+        _buffer.resize(size);
+      }
+    }
+  };
+
+  // How much Serializer::commit() waits for before the replaced file is
+  // considered written.
+  enum class Durability {
+    // Nothing is synced; a crash may leave the new file empty or partial,
+    // though never under the final name before commit().
+    none,
+    // The file's contents are synced with fdatasync() before the rename.
+    data,
+    // The file is synced with fsync() before the rename and its directory
+    // afterwards, so the rename itself survives a crash.
+    full,
+  };
+
+  struct SerializerOptions {
+    // Size the file is expected to reach. Disk space for it is allocated up
+    // front, see Serializer::reserve_file_size().
+    uint64_t expected_size = 0;
+
+    // Writes to a temporary file in the same directory, which replaces the
+    // target file only on Serializer::commit(). A serializer that is
+    // destroyed without committing removes its temporary file, leaving any
+    // previous file untouched.
+    bool atomic_replace = false;
+
+    Durability durability = Durability::none;
+
+    // Keeps the existing contents of the file, creating it if needed, and
+    // starts writing at its end. Ignored with atomic_replace.
+    bool append = false;
+
+    // Size of the stdio write buffer, or 0 for the stdio default.
+    uint64_t buffer_size = 0;
+
+    // Allocates the write buffer from huge pages, see PageBuffer.
+    bool huge_pages = false;
+
+    // Borrows the write buffer from this pool instead of allocating it.
+    PageBufferPool *buffer_pool = nullptr;
+  };
+
+  class Deserializer;
+
   class Serializer {
-    static constexpr size_t _num_zeroes = alignof(std::max_align_t);
-    static constinit std::byte const _zeroes[_num_zeroes] = {0};
+    static constexpr size_t _num_zeroes = 4096;
+    static constexpr std::byte _zeroes[_num_zeroes] = {};
+
+    // Alignment padding at least this large, at the end of the file, is
+    // seeked over rather than written, leaving a hole that reads as zeroes.
+    static constexpr uint64_t _hole_threshold = _num_zeroes;
+
+    // write_iov() writes at least this many bytes directly with pwritev.
+    static constexpr uint64_t _direct_write_size = 64 * 1024;
 
     FILE *_file;
     uint64_t _offset;
+    uint64_t _end_offset;
+    // Whether the file may end in a skipped or preallocated tail that has
+    // to be cut to _end_offset on close.
+    bool _resize_needed;
     DestructorExceptions *_exceptions;
     std::string _filename;
+    std::string _temp_filename;
+    Durability _durability;
+    PageBuffer _write_buffer;
+    PageBufferPool *_buffer_pool;
 
   public:
     ~Serializer() noexcept
@@ -105,31 +651,87 @@ namespace pickaxe {
         _close();
       }
       catch (CloseException const &e) {
-        _exceptions->exceptions.push_back(e);
+        _exceptions->close.push_back(e);
       }
+      _release_buffer();
     }
 
     Serializer(
       DestructorExceptions &exceptions,
       char const *filename)
-      : _file(std::fopen(filename, "wb"))
+      : Serializer(exceptions, filename, SerializerOptions{})
+    {}
+
+    Serializer(
+      DestructorExceptions &exceptions,
+      char const *filename,
+      SerializerOptions const &options)
+      : _file(nullptr)
       , _offset(0)
+      , _end_offset(0)
+      , _resize_needed(false)
       , _exceptions(&exceptions)
       , _filename(filename)
+      , _durability(options.durability)
+      , _buffer_pool(options.buffer_pool)
     {
+      if (options.atomic_replace) {
+        _file = _open_temporary();
+      }
+      else if (options.append) {
+        _file = std::fopen(filename, "r+b");
+        if (_file == nullptr && errno == ENOENT) {
+          _file = std::fopen(filename, "w+b");
+        }
+      }
+      else {
+        _file = std::fopen(filename, "wb");
+      }
       if (_file == nullptr) {
         throw WriteException(_filename, "failed to open");
       }
+      if (options.buffer_size != 0) {
+        _write_buffer = _buffer_pool != nullptr
+          ? _buffer_pool->acquire(options.buffer_size)
+          : PageBuffer(options.buffer_size, options.huge_pages);
+        std::setvbuf(_file, reinterpret_cast<char *>(_write_buffer.get_data()), _IOFBF, options.buffer_size);
+      }
+      if (options.append || options.expected_size != 0) {
+        try {
+          if (options.append && !options.atomic_replace) {
+            _seek_to_end();
+          }
+          if (options.expected_size != 0) {
+            reserve_file_size(options.expected_size);
+          }
+        }
+        catch (...) {
+          try {
+            _close();
+          }
+          catch (CloseException const &) {
+          }
+          _release_buffer();
+          throw;
+        }
+      }
     }
 
     Serializer(
       Serializer &&other) noexcept
       : _file(std::move(other._file))
       , _offset(std::move(other._offset))
+      , _end_offset(std::move(other._end_offset))
+      , _resize_needed(std::move(other._resize_needed))
       , _exceptions(std::move(other._exceptions))
       , _filename(std::move(other._filename))
+      , _temp_filename(std::move(other._temp_filename))
+      , _durability(std::move(other._durability))
+      , _write_buffer(std::move(other._write_buffer))
+      , _buffer_pool(std::move(other._buffer_pool))
     {
       other._file = nullptr;
+      other._temp_filename.clear();
     }
 
     Serializer(Serializer const &) = delete;
@@ -140,14 +742,36 @@ namespace pickaxe {
       _close();
       _file = std::move(other._file);
       _offset = std::move(other._offset);
+      _end_offset = std::move(other._end_offset);
+      _resize_needed = std::move(other._resize_needed);
       _exceptions = std::move(other._exceptions);
       _filename = std::move(other._filename);
+      _temp_filename = std::move(other._temp_filename);
+      _durability = std::move(other._durability);
+      _release_buffer();
+      _write_buffer = std::move(other._write_buffer);
+      _buffer_pool = std::move(other._buffer_pool);
       other._file = nullptr;
+      other._temp_filename.clear();
       return *this;
     }
 
     Serializer &operator=(Serializer const &) = delete;
 
+    [[nodiscard]] std::string const &get_filename() const
+    {
+      return _filename;
+    }
+
+#if defined(PICKAXE_POSIX)
+    // For system calls that stdio has no equivalent of. Call flush() first
+    // if they need to see everything written so far.
+    [[nodiscard]] int get_file_descriptor() const
+    {
+      return ::fileno(_file);
+    }
+#endif
+
     [[nodiscard]] uint64_t get_offset() const
     {
       return _offset;
@@ -174,6 +798,64 @@ namespace pickaxe {
       set_offset(new_offset);
     }
 
+    // Allocates disk space for the first size bytes of the file so that it
+    // does not fragment or update metadata as it grows. Allocated space that
+    // is never written to is truncated on close. This is only a hint where
+    // the platform or filesystem cannot preallocate.
+    void reserve_file_size(
+      uint64_t size)
+    {
+      _resize_needed = true;
+#if defined(__linux__)
+      auto ret = ::fallocate(::fileno(_file), 0, 0, static_cast<off_t>(size));
+      // Devices, pipes and FIFOs have no space to allocate.
+      if (ret != 0 && errno != EOPNOTSUPP && errno != ENODEV && errno != ESPIPE) {
+        throw WriteException(_filename, "failed to preallocate");
+      }
+#elif defined(PICKAXE_POSIX) && !defined(__APPLE__)
+      auto ret = ::posix_fallocate(::fileno(_file), 0, static_cast<off_t>(size));
+      if (ret != 0 && ret != EINVAL && ret != EOPNOTSUPP && ret != ENODEV && ret != ESPIPE) {
+        throw WriteException(_filename, "failed to preallocate");
+      }
+#else
+      (void)size;
+#endif
+    }
+
+    // Advances the offset by size bytes without writing them. Whatever part
+    // of them lies past the end of the file is left as a hole, which reads
+    // as zeroes and, where the filesystem supports it, takes no disk space.
+    void skip(
+      uint64_t size)
+    {
+      uint64_t target = _offset + size;
+#if defined(PICKAXE_POSIX)
+      set_offset(target);
+      if (target > _end_offset) {
+        _end_offset = target;
+        _resize_needed = true;
+      }
+#else
+      if (target <= _end_offset) {
+        set_offset(target);
+      }
+      else {
+        set_offset(std::max(_offset, _end_offset));
+        _write_zeroes(target - _offset);
+      }
+#endif
+    }
+
+    // Skips a region of size bytes to be filled in later through
+    // set_offset(), and returns the offset of the region.
+    uint64_t reserve_region(
+      uint64_t size)
+    {
+      auto offset = _offset;
+      skip(size);
+      return offset;
+    }
+
     template <typename T>
     void write(
       T const &data)
@@ -199,6 +881,7 @@ namespace pickaxe {
         throw WriteException(_filename);
       }
       _offset += size;
+      _end_offset = std::max(_end_offset, _offset);
     }
 
     void write_aligned(
@@ -206,74 +889,388 @@ namespace pickaxe {
       uint64_t size,
       uint64_t alignment)
     {
-      uint64_t mod = _offset % alignment;
-      if (mod != 0) {
-        uint64_t padding = alignment - mod;
-        while (padding > _num_zeroes) {
-          write(_zeroes, _num_zeroes);
-          padding -= _num_zeroes;
-        }
-        write(_zeroes, padding);
-      }
+      _pad(alignment);
       write(data, size);
     }
 
-    void flush()
+#if defined(PICKAXE_POSIX)
+    // Writes the buffers back to back at the current offset. Once they add
+    // up to _direct_write_size bytes, the stdio buffer is flushed and they
+    // are written with pwritev, so that large payloads are not first copied
+    // into the buffer only to be flushed straight away.
+    void write_iov(
+      std::span<iovec const> buffers)
     {
-      auto ret = std::fflush(_file);
-      if (ret != 0) {
-        throw WriteException(_filename, "failed to flush");
+      uint64_t size = 0;
+      for (auto const &buffer : buffers) {
+        size += buffer.iov_len;
       }
-    }
-    
-  private:
+      if (size < _direct_write_size) {
+        for (auto const &buffer : buffers) {
+          write(buffer.iov_base, buffer.iov_len);
+        }
+        return;
+      }
+      flush();
+      std::vector<iovec> vectors(buffers.begin(), buffers.end());
+      auto *vector = vectors.data();
+      uint64_t count = vectors.size();
+      auto offset = _offset;
+      advance_iovecs(vector, count, 0);
+      while (count != 0) {
+        auto ret = ::pwritev(::fileno(_file), vector, static_cast<int>(std::min(count, max_iovecs)), static_cast<off_t>(offset));
+        if (ret <= 0) {
+          if (ret < 0 && errno == EINTR) {
+            continue;
+          }
+          throw WriteException(_filename);
+        }
+        offset += static_cast<uint64_t>(ret);
+        advance_iovecs(vector, count, static_cast<uint64_t>(ret));
+      }
+      set_offset(offset);
+      _end_offset = std::max(_end_offset, _offset);
+    }
+
+    // Writes each part, which is either a POD value or a contiguous range
+    // such as a std::span or std::vector, with a single write_iov(). Meant
+    // for records made of a header, a large payload and a trailer.
+    template <typename... Parts>
+    void write_gather(
+      Parts const &...parts)
+    {
+      iovec buffers[] = {_to_iovec(parts)...};
+      write_iov(buffers);
+    }
+#endif
+
+    void write_varint(
+      uint64_t value)
+    {
+      uint8_t bytes[max_varint_size];
+      write(bytes, encode_varint(value, bytes));
+    }
+
+    void write_string(
+      std::string_view value)
+    {
+      encode_string(*this, value);
+    }
+
+    template <typename Range>
+    void write_vector(
+      Range const &values)
+    {
+      encode_vector(*this, values);
+    }
+
+    template <typename Map>
+    void write_map(
+      Map const &map)
+    {
+      encode_map(*this, map);
+    }
+
+    // Writes a section serialized on its own, padded the way write_aligned()
+    // pads so that every alignment used inside the section still holds, and
+    // with every offset recorded by MemorySerializer::write_offset() rebased
+    // onto the section's place in this file. Returns that place.
+    uint64_t splice(
+      MemorySerializer const &section)
+    {
+      _pad(section.get_alignment());
+      uint64_t base = _offset;
+      auto relocations = section.get_relocations();
+      std::sort(relocations.begin(), relocations.end());
+      relocations.erase(std::unique(relocations.begin(), relocations.end()), relocations.end());
+      auto const *data = section.get_data();
+      uint64_t position = 0;
+      for (auto relocation : relocations) {
+        if (relocation > position) {
+          write(data + position, relocation - position);
+        }
+        uint64_t value;
+        std::memcpy(&value, data + relocation, sizeof(value));
+        write(value + base);
+        position = relocation + sizeof(value);
+      }
+      if (section.get_size() > position) {
+        write(data + position, section.get_size() - position);
+      }
+      return base;
+    }
+
+    // Copies size bytes from the current offset of source to the current
+    // offset of this file, advancing both. Whatever source has already
+    // buffered is written from its buffer, and the rest is copied by the
+    // kernel with copy_file_range(), or sendfile() where that is not
+    // supported, without passing through user space. Elsewhere the bytes
+    // are read and written through a buffer.
+    void copy_from(
+      Deserializer &source,
+      uint64_t size);
+
+    void flush()
+    {
+      auto ret = std::fflush(_file);
+      if (ret != 0) {
+        throw WriteException(_filename, "failed to flush");
+      }
+    }
+
+    // Finishes a serializer opened with SerializerOptions::atomic_replace:
+    // syncs the temporary file as the durability level asks, closes it and
+    // renames it over the target file. The serializer is closed afterwards.
+    void commit()
+    {
+      if (_temp_filename.empty()) {
+        throw WriteException(_filename, "not opened for atomic replacement");
+      }
+#if defined(PICKAXE_POSIX)
+      if (!_resize_file()) {
+        throw WriteException(_filename, "failed to flush");
+      }
+      int fd = ::fileno(_file);
+      if (_durability == Durability::data) {
+#if defined(__APPLE__)
+        auto ret = ::fsync(fd);
+#else
+        auto ret = ::fdatasync(fd);
+#endif
+        if (ret != 0) {
+          throw WriteException(_filename, "failed to sync");
+        }
+      }
+      else if (_durability == Durability::full) {
+        if (::fsync(fd) != 0) {
+          throw WriteException(_filename, "failed to sync");
+        }
+      }
+      auto ret = std::fclose(_file);
+      _file = nullptr;
+      auto temp_filename = std::move(_temp_filename);
+      _temp_filename.clear();
+      if (ret != 0) {
+        ::unlink(temp_filename.c_str());
+        throw CloseException(_filename);
+      }
+      if (std::rename(temp_filename.c_str(), _filename.c_str()) != 0) {
+        ::unlink(temp_filename.c_str());
+        throw WriteException(_filename, "failed to replace");
+      }
+      if (_durability == Durability::full) {
+        _sync_directory();
+      }
+#endif
+    }
+
+  private:
+    void _release_buffer()
+    {
+      if (_buffer_pool != nullptr) {
+        _buffer_pool->release(std::move(_write_buffer));
+      }
+    }
+
+    void _pad(
+      uint64_t alignment)
+    {
+      uint64_t mod = _offset % alignment;
+      if (mod != 0) {
+        uint64_t padding = alignment - mod;
+        if (padding >= _hole_threshold && _offset >= _end_offset) {
+          skip(padding);
+        }
+        else {
+          _write_zeroes(padding);
+        }
+      }
+    }
+
+#if defined(PICKAXE_POSIX)
+    template <typename T>
+    static iovec _to_iovec(
+      T const &part)
+    {
+      if constexpr (std::is_pod_v<T>) {
+        return {const_cast<T *>(&part), sizeof(T)};
+      }
+      else {
+        auto bytes = std::as_bytes(std::span(part));
+        return {const_cast<std::byte *>(bytes.data()), bytes.size()};
+      }
+    }
+#endif
+
+    void _seek_to_end()
+    {
+      auto ret = std::fseek(_file, 0, SEEK_END);
+      auto size = std::ftell(_file);
+      if (ret != 0 || size < 0) {
+        throw WriteException(_filename, "failed to seek");
+      }
+      _offset = static_cast<uint64_t>(size);
+      _end_offset = _offset;
+    }
+
+    [[nodiscard]] FILE *_open_temporary()
+    {
+#if defined(PICKAXE_POSIX)
+      static std::atomic<uint64_t> counter{0};
+      while (true) {
+        auto name = _filename + ".tmp." + std::to_string(::getpid()) + "." + std::to_string(counter++);
+        int fd = ::open(name.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+        if (fd < 0) {
+          if (errno == EEXIST) {
+            continue;
+          }
+          return nullptr;
+        }
+        auto *file = ::fdopen(fd, "wb");
+        if (file == nullptr) {
+          ::close(fd);
+          ::unlink(name.c_str());
+          return nullptr;
+        }
+        _temp_filename = std::move(name);
+        return file;
+      }
+#else
+      throw WriteException(_filename, "atomic replacement is not supported on this platform");
+#endif
+    }
+
+#if defined(PICKAXE_POSIX)
+    void _sync_directory()
+    {
+      auto slash = _filename.rfind('/');
+      std::string directory = slash == std::string::npos ? "." : slash == 0 ? "/" : _filename.substr(0, slash);
+      int fd = ::open(directory.c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd < 0) {
+        throw WriteException(_filename, "failed to open directory for sync");
+      }
+      auto ret = ::fsync(fd);
+      ::close(fd);
+      if (ret != 0) {
+        throw WriteException(_filename, "failed to sync directory");
+      }
+    }
+#endif
+
+    void _write_zeroes(
+      uint64_t size)
+    {
+      while (size > _num_zeroes) {
+        write(_zeroes, _num_zeroes);
+        size -= _num_zeroes;
+      }
+      write(_zeroes, size);
+    }
+
+    // Makes the file exactly _end_offset bytes long, which matters when it
+    // ends in a skipped region that was never written to, or in preallocated
+    // space that was never used.
+    [[nodiscard]] bool _resize_file()
+    {
+#if defined(PICKAXE_POSIX)
+      if (std::fflush(_file) != 0) {
+        return false;
+      }
+      if (!_resize_needed) {
+        return true;
+      }
+      int fd = ::fileno(_file);
+      struct stat status;
+      if (::fstat(fd, &status) != 0) {
+        return false;
+      }
+      // Devices, pipes and FIFOs have no size to fix.
+      if (S_ISREG(status.st_mode) && static_cast<uint64_t>(status.st_size) != _end_offset) {
+        return ::ftruncate(fd, static_cast<off_t>(_end_offset)) == 0;
+      }
+#endif
+      return true;
+    }
+
     void _close()
     {
       if (_file != nullptr) {
+        auto resized = _resize_file();
         auto ret = std::fclose(_file);
-        if (ret != 0) {
+        _file = nullptr;
+#if defined(PICKAXE_POSIX)
+        if (!_temp_filename.empty()) {
+          ::unlink(_temp_filename.c_str());
+          _temp_filename.clear();
+        }
+#endif
+        if (ret != 0 || !resized) {
           throw CloseException(_filename);
         }
-        _file = nullptr;
       }
     }
   };
 
+  // How a Deserializer expects to move through its file, passed on to the
+  // kernel with posix_fadvise().
+  enum class AccessPattern {
+    normal,
+    // Reads ahead aggressively and drops pages from the page cache once
+    // they have been read past, so long scans do not evict other data.
+    sequential,
+    random,
+    // Switches between normal, sequential and random based on how pages
+    // are actually read and seeked.
+    automatic,
+  };
+
   class Deserializer {
+    friend class Serializer;
+
+    static constexpr uint64_t _min_readahead_size = 4 * 1024 * 1024;
+    static constexpr uint64_t _sequential_page_threshold = 2;
+    static constexpr uint64_t _random_seek_threshold = 4;
+
     FILE *_file;
     uint64_t _target_page_size;
     uint64_t _active_page_size;
     uint64_t _file_offset_page_begin;
     uint64_t _file_offset_page_end;
     uint64_t _read_buffer_offset;
+    AccessPattern _access_pattern;
+    AccessPattern _advised_pattern;
+    uint64_t _sequential_pages;
+    uint64_t _random_seeks;
+    uint64_t _will_need_end;
+    uint64_t _dont_need_offset;
     DestructorExceptions *_exceptions;
     std::string _filename;
-    std::vector<std::byte> _read_buffer;
-
-  public:
-    ~Deserializer() noexcept
-    {
-      try {
-        _close();
-      }
-      catch (CloseException const &e) {
-        _exceptions->exceptions.push_back(e);
-      }
-    }
+    bool _huge_pages;
+    PageBuffer _read_buffer;
+    PageBufferPool *_buffer_pool;
 
     Deserializer(
       DestructorExceptions &exceptions,
       char const *filename,
-      uint64_t page_size)
+      uint64_t page_size,
+      bool huge_pages,
+      PageBufferPool *buffer_pool)
       : _file(std::fopen(filename, "rb"))
       , _target_page_size(page_size)
       , _active_page_size(0)
       , _file_offset_page_begin(0)
       , _file_offset_page_end(0)
-      , _read_buffer_offset(page_size)
+      , _read_buffer_offset(0)
+      , _access_pattern(AccessPattern::normal)
+      , _advised_pattern(AccessPattern::normal)
+      , _sequential_pages(0)
+      , _random_seeks(0)
+      , _will_need_end(0)
+      , _dont_need_offset(0)
       , _exceptions(&exceptions)
       , _filename(filename)
-      , _read_buffer(std::byte{}, page_size)
+      , _huge_pages(huge_pages)
+      , _buffer_pool(buffer_pool)
     {
       if (_file == nullptr) {
         throw ReadException(_filename, "failed to open");
@@ -281,8 +1278,44 @@ namespace pickaxe {
       if (page_size == 0) {
         throw InvalidPageSizeException(page_size);
       }
+      _read_buffer = _allocate_buffer(page_size);
+      // Pages are read straight into _read_buffer, so stdio buffering would
+      // only add a second copy.
+      std::setvbuf(_file, nullptr, _IONBF, 0);
+    }
+
+  public:
+    ~Deserializer() noexcept
+    {
+      try {
+        _close();
+      }
+      catch (CloseException const &e) {
+        _exceptions->close.push_back(e);
+      }
+      _release_buffer();
     }
 
+    // With huge_pages, pages of at least PageBuffer::huge_page_size are
+    // read into a buffer backed by huge pages.
+    Deserializer(
+      DestructorExceptions &exceptions,
+      char const *filename,
+      uint64_t page_size,
+      bool huge_pages = false)
+      : Deserializer(exceptions, filename, page_size, huge_pages, nullptr)
+    {}
+
+    // Borrows the page buffer from buffer_pool, and returns it when
+    // destroyed.
+    Deserializer(
+      DestructorExceptions &exceptions,
+      char const *filename,
+      uint64_t page_size,
+      PageBufferPool &buffer_pool)
+      : Deserializer(exceptions, filename, page_size, false, &buffer_pool)
+    {}
+
     Deserializer(
       Deserializer &&other) noexcept
       : _file(std::move(other._file))
@@ -291,9 +1324,17 @@ namespace pickaxe {
       , _file_offset_page_begin(std::move(other._file_offset_page_begin))
       , _file_offset_page_end(std::move(other._file_offset_page_end))
       , _read_buffer_offset(std::move(other._read_buffer_offset))
+      , _access_pattern(std::move(other._access_pattern))
+      , _advised_pattern(std::move(other._advised_pattern))
+      , _sequential_pages(std::move(other._sequential_pages))
+      , _random_seeks(std::move(other._random_seeks))
+      , _will_need_end(std::move(other._will_need_end))
+      , _dont_need_offset(std::move(other._dont_need_offset))
       , _exceptions(std::move(other._exceptions))
       , _filename(std::move(other._filename))
+      , _huge_pages(std::move(other._huge_pages))
       , _read_buffer(std::move(other._read_buffer))
+      , _buffer_pool(std::move(other._buffer_pool))
     {
       other._file = nullptr;
     }
@@ -310,15 +1351,29 @@ namespace pickaxe {
       _file_offset_page_begin = std::move(other._file_offset_page_begin);
       _file_offset_page_end = std::move(other._file_offset_page_end);
       _read_buffer_offset = std::move(other._read_buffer_offset);
+      _access_pattern = std::move(other._access_pattern);
+      _advised_pattern = std::move(other._advised_pattern);
+      _sequential_pages = std::move(other._sequential_pages);
+      _random_seeks = std::move(other._random_seeks);
+      _will_need_end = std::move(other._will_need_end);
+      _dont_need_offset = std::move(other._dont_need_offset);
       _exceptions = std::move(other._exceptions);
       _filename = std::move(other._filename);
+      _huge_pages = std::move(other._huge_pages);
+      _release_buffer();
       _read_buffer = std::move(other._read_buffer);
+      _buffer_pool = std::move(other._buffer_pool);
       other._file = nullptr;
       return *this;
     }
 
     Deserializer &operator=(Deserializer const &) = delete;
 
+    [[nodiscard]] std::string const &get_filename() const
+    {
+      return _filename;
+    }
+
     [[nodiscard]] uint64_t get_page_size() const
     {
       return _target_page_size;
@@ -331,11 +1386,59 @@ namespace pickaxe {
         throw InvalidPageSizeException(new_page_size);
       }
       _target_page_size = new_page_size;
-      if (_read_buffer.size() < _target_page_size) {
-        _read_buffer.resize(_target_page_size);
+      if (_read_buffer.get_size() < _target_page_size) {
+        auto buffer = _allocate_buffer(_target_page_size);
+        std::memcpy(buffer.get_data(), _read_buffer.get_data(), _active_page_size);
+        std::swap(_read_buffer, buffer);
+        if (_buffer_pool != nullptr) {
+          _buffer_pool->release(std::move(buffer));
+        }
       }
     }
 
+    [[nodiscard]] AccessPattern get_access_pattern() const
+    {
+      return _access_pattern;
+    }
+
+    void set_access_pattern(
+      AccessPattern pattern)
+    {
+      _access_pattern = pattern;
+      _sequential_pages = 0;
+      _random_seeks = 0;
+      _will_need_end = _file_offset_page_end;
+      _dont_need_offset = _file_offset_page_begin;
+      _advise_pattern(pattern == AccessPattern::automatic ? AccessPattern::normal : pattern);
+    }
+
+    // Asks the kernel to start reading the given range into the page cache.
+    void will_need(
+      uint64_t offset,
+      uint64_t size)
+    {
+#if defined(POSIX_FADV_WILLNEED)
+      _advise(offset, size, POSIX_FADV_WILLNEED);
+#else
+      (void)offset;
+      (void)size;
+#endif
+    }
+
+    // Tells the kernel the given range will not be read again, so its pages
+    // can be dropped from the page cache.
+    void dont_need(
+      uint64_t offset,
+      uint64_t size)
+    {
+#if defined(POSIX_FADV_DONTNEED)
+      _advise(offset, size, POSIX_FADV_DONTNEED);
+#else
+      (void)offset;
+      (void)size;
+#endif
+    }
+
     [[nodiscard]] uint64_t get_offset() const
     {
       return _file_offset_page_begin + _read_buffer_offset;
@@ -349,13 +1452,62 @@ namespace pickaxe {
         _read_buffer_offset = delta;
         return;
       }
-      auto ret = std::fseek(_file, new_offset, SEEK_SET);
+      if (new_offset != _file_offset_page_end) {
+        _track_seek(new_offset);
+      }
+      _seek_file(new_offset);
+    }
+
+    [[nodiscard]] uint64_t get_file_size()
+    {
+      auto ret = std::fseek(_file, 0, SEEK_END);
       if (ret != 0) {
-        throw ReadException(_filename);
+        throw ReadException(_filename, "failed to seek");
       }
-      _file_offset_page_begin = new_offset;
-      _file_offset_page_end = new_offset;
-      _read_buffer_offset = _active_page_size;
+      auto size = std::ftell(_file);
+      if (size < 0) {
+        throw ReadException(_filename, "failed to query size");
+      }
+      ret = std::fseek(_file, _file_offset_page_end, SEEK_SET);
+      if (ret != 0) {
+        throw ReadException(_filename, "failed to seek");
+      }
+      return static_cast<uint64_t>(size);
+    }
+
+    // Returns the first offset at or after offset that is not inside a
+    // hole, or the file size if only holes follow.
+    [[nodiscard]] uint64_t find_data(
+      uint64_t offset)
+    {
+#if defined(SEEK_DATA)
+      return _seek_query(offset, SEEK_DATA);
+#else
+      return std::min(offset, get_file_size());
+#endif
+    }
+
+    // Returns the first offset at or after offset that is inside a hole.
+    // The end of the file counts as a hole.
+    [[nodiscard]] uint64_t find_hole(
+      uint64_t offset)
+    {
+#if defined(SEEK_HOLE)
+      return _seek_query(offset, SEEK_HOLE);
+#else
+      (void)offset;
+      return get_file_size();
+#endif
+    }
+
+    // Moves past the hole at the current offset, if any, so that scans do
+    // not read through regions that were skipped by the writer. Returns the
+    // new offset.
+    uint64_t skip_hole()
+    {
+      auto offset = find_data(get_offset());
+      set_offset(offset);
+      return offset;
     }
 
     [[nodiscard]] bool is_eof() const
@@ -385,15 +1537,15 @@ namespace pickaxe {
     {
       while (_read_buffer_offset + size > _active_page_size) {
         uint64_t lead = _active_page_size - _read_buffer_offset;
-        std::memcpy(dest, _read_buffer.data() + _read_buffer_offset, lead);
+        std::memcpy(dest, _read_buffer.get_data() + _read_buffer_offset, lead);
         dest += lead;
         size -= lead;
         auto n = _read_page();
-        if (n < _active_page_size && n < size) {
+        if (n == 0) {
           throw ReadException(_filename, "not enough remaining bytes at current offset");
         }
       }
-      std::memcpy(dest, _read_buffer.data() + _read_buffer_offset, size);
+      std::memcpy(dest, _read_buffer.get_data() + _read_buffer_offset, size);
       _read_buffer_offset += size;
     }
 
@@ -402,28 +1554,150 @@ namespace pickaxe {
       uint64_t size,
       uint64_t alignment)
     {
-      uint64_t mod = _read_buffer_offset % alignment;
+      uint64_t offset = get_offset();
+      uint64_t mod = offset % alignment;
       if (mod != 0) {
-        uint64_t padding = alignment - mod;
-        if (_read_buffer_offset + padding > _active_page_size) {
-          (void)_read_page();
-        }
-        else {
-          _read_buffer_offset += padding;
-        }
+        set_offset(offset + alignment - mod);
       }
       read(dest, size);
     }
 
+    // Reads a varint written by Serializer::write_varint().
+    [[nodiscard]] uint64_t read_varint()
+    {
+      uint64_t value = 0;
+      for (uint64_t shift = 0; shift < 64; shift += 7) {
+        uint8_t byte;
+        read(byte);
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+          return value;
+        }
+      }
+      throw ReadException(_filename, "varint is too long");
+    }
+
+    // Reads a string written by Serializer::write_string(), allocated from
+    // resource.
+    [[nodiscard]] std::pmr::string read_string(
+      std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+    {
+      auto size = read_varint();
+      check_remaining(size);
+      std::pmr::string value(resource);
+      value.resize(size);
+      if (!value.empty()) {
+        read(reinterpret_cast<std::byte *>(value.data()), value.size());
+      }
+      return value;
+    }
+
+    // Reads values written by Serializer::write_vector(), allocated from
+    // resource.
+    template <typename T>
+    [[nodiscard]] std::pmr::vector<T> read_vector(
+      std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+    {
+      static_assert(std::is_pod_v<T>);
+      auto count = read_varint();
+      check_remaining(count, sizeof(T));
+      std::pmr::vector<T> values(resource);
+      values.resize(count);
+      if (!values.empty()) {
+        read(reinterpret_cast<std::byte *>(values.data()), values.size() * sizeof(T));
+      }
+      return values;
+    }
+
+    // Reads a map written by Serializer::write_map() into a std::pmr map
+    // type, such as std::pmr::map<std::pmr::string, uint64_t>. The map and
+    // every string in it are allocated from resource, so with a
+    // std::pmr::monotonic_buffer_resource a whole load is freed at once.
+    template <typename Map>
+    [[nodiscard]] Map read_map(
+      std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+    {
+      Map map(resource);
+      auto size = read_varint();
+      // Every entry takes at least one byte.
+      check_remaining(size);
+      if constexpr (requires { map.reserve(size); }) {
+        map.reserve(size);
+      }
+      for (uint64_t i = 0; i < size; ++i) {
+        auto key = _read_element<typename Map::key_type>(resource);
+        auto value = _read_element<typename Map::mapped_type>(resource);
+        map.emplace(std::move(key), std::move(value));
+      }
+      return map;
+    }
+
+    // Rejects a decoded length of count elements of element_size bytes
+    // that the rest of the file cannot hold, before anything is allocated
+    // for it. The file size is only queried when the current page does not
+    // already hold the whole length.
+    void check_remaining(
+      uint64_t count,
+      uint64_t element_size = 1)
+    {
+      if (count <= (_active_page_size - _read_buffer_offset) / element_size) {
+        return;
+      }
+      auto file_size = get_file_size();
+      auto offset = get_offset();
+      if (offset > file_size || count > (file_size - offset) / element_size) {
+        throw ReadException(_filename, "length exceeds the remaining file size");
+      }
+    }
+
   private:
-    [[nodiscard]] uint64_t _read_page()
+
+    template <typename T>
+    [[nodiscard]] T _read_element(
+      std::pmr::memory_resource *resource)
+    {
+      if constexpr (std::is_same_v<T, std::pmr::string>) {
+        return read_string(resource);
+      }
+      else {
+        static_assert(std::is_pod_v<T>);
+        T value;
+        read(value);
+        return value;
+      }
+    }
+
+    [[nodiscard]] PageBuffer _allocate_buffer(
+      uint64_t size)
+    {
+      return _buffer_pool != nullptr ? _buffer_pool->acquire(size) : PageBuffer(size, _huge_pages);
+    }
+
+    void _release_buffer()
+    {
+      if (_buffer_pool != nullptr) {
+        _buffer_pool->release(std::move(_read_buffer));
+      }
+    }
+
+    // Moves the file position, discarding the current page.
+    void _seek_file(
+      uint64_t new_offset)
     {
-      if (_active_page_size != _target_page_size) {
-        _active_page_size = _target_page_size;
-        std::setvbuf(_file, reinterpret_cast<char *>(_read_buffer.data()), _IOFBF, _active_page_size);
+      auto ret = std::fseek(_file, new_offset, SEEK_SET);
+      if (ret != 0) {
+        throw ReadException(_filename);
       }
-      auto size = _active_page_size;
-      auto n = std::fread(_read_buffer.data(), 1, size, _file);
+      _file_offset_page_begin = new_offset;
+      _file_offset_page_end = new_offset;
+      _active_page_size = 0;
+      _read_buffer_offset = 0;
+    }
+
+    [[nodiscard]] uint64_t _read_page()
+    {
+      auto size = _target_page_size;
+      auto n = std::fread(_read_buffer.get_data(), 1, size, _file);
       if (n != size) {
         if (std::ferror(_file) || !is_eof()) {
           throw ReadException(_filename);
@@ -432,22 +1706,2926 @@ namespace pickaxe {
       }
       _file_offset_page_begin = _file_offset_page_end;
       _file_offset_page_end += size;
+      _active_page_size = size;
       _read_buffer_offset = 0;
+      _track_page();
       return size;
     }
 
-    void _close()
+    void _track_seek(
+      uint64_t new_offset)
     {
-      if (_file != nullptr) {
-        auto ret = std::fclose(_file);
-        if (ret != 0) {
-          throw CloseException(_filename);
-        }
+      _will_need_end = new_offset;
+      _dont_need_offset = new_offset;
+      if (_access_pattern == AccessPattern::automatic) {
+        _sequential_pages = 0;
+        ++_random_seeks;
+        _advise_pattern(_random_seeks >= _random_seek_threshold ? AccessPattern::random : AccessPattern::normal);
+      }
+    }
+
+    // Keeps a readahead window in front of sequential scans and drops the
+    // pages behind them.
+    void _track_page()
+    {
+      if (_access_pattern == AccessPattern::automatic) {
+        if (++_sequential_pages >= _sequential_page_threshold) {
+          _random_seeks = 0;
+          _advise_pattern(AccessPattern::sequential);
+        }
+      }
+      if (_advised_pattern != AccessPattern::sequential) {
+        return;
+      }
+      uint64_t window = std::max(_target_page_size * 4, _min_readahead_size);
+      if (_will_need_end < _file_offset_page_end + window / 2) {
+        auto begin = std::max(_will_need_end, _file_offset_page_end);
+        will_need(begin, _file_offset_page_end + window - begin);
+        _will_need_end = _file_offset_page_end + window;
+      }
+      if (_file_offset_page_begin >= _dont_need_offset + window) {
+        dont_need(_dont_need_offset, _file_offset_page_begin - _dont_need_offset);
+        _dont_need_offset = _file_offset_page_begin;
+      }
+    }
+
+    void _advise_pattern(
+      AccessPattern pattern)
+    {
+      if (pattern == _advised_pattern) {
+        return;
+      }
+      _advised_pattern = pattern;
+#if defined(POSIX_FADV_NORMAL)
+      switch (pattern) {
+      case AccessPattern::sequential:
+        _advise(0, 0, POSIX_FADV_SEQUENTIAL);
+        break;
+      case AccessPattern::random:
+        _advise(0, 0, POSIX_FADV_RANDOM);
+        break;
+      default:
+        _advise(0, 0, POSIX_FADV_NORMAL);
+        break;
+      }
+#endif
+    }
+
+#if defined(POSIX_FADV_NORMAL)
+    // Advice is only a hint, so failures are ignored.
+    void _advise(
+      uint64_t offset,
+      uint64_t size,
+      int advice)
+    {
+      (void)::posix_fadvise(::fileno(_file), static_cast<off_t>(offset), static_cast<off_t>(size), advice);
+    }
+#endif
+
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+    [[nodiscard]] uint64_t _seek_query(
+      uint64_t offset,
+      int whence)
+    {
+      auto result = ::lseek(::fileno(_file), static_cast<off_t>(offset), whence);
+      auto error = errno;
+      auto ret = std::fseek(_file, _file_offset_page_end, SEEK_SET);
+      if (ret != 0) {
+        throw ReadException(_filename, "failed to seek");
+      }
+      if (result >= 0) {
+        return static_cast<uint64_t>(result);
+      }
+      if (error == ENXIO) {
+        return get_file_size();
+      }
+      throw ReadException(_filename, "failed to seek");
+    }
+#endif
+
+    void _close()
+    {
+      if (_file != nullptr) {
+        auto ret = std::fclose(_file);
+        if (ret != 0) {
+          throw CloseException(_filename);
+        }
         _file = nullptr;
       }
     }
   };
 
+  inline void Serializer::copy_from(
+    Deserializer &source,
+    uint64_t size)
+  {
+    auto buffered = std::min(size, source._active_page_size - source._read_buffer_offset);
+    if (buffered != 0) {
+      write(source._read_buffer.get_data() + source._read_buffer_offset, buffered);
+      source._read_buffer_offset += buffered;
+      size -= buffered;
+    }
+#if defined(__linux__)
+    if (size != 0) {
+      flush();
+      auto in_fd = ::fileno(source._file);
+      auto out_fd = ::fileno(_file);
+      // The source's buffer is used up, so its file position is its offset.
+      auto in_offset = static_cast<off_t>(source._file_offset_page_end);
+      auto out_offset = static_cast<off_t>(_offset);
+      bool use_copy_file_range = true;
+      bool use_sendfile = true;
+      uint64_t copied = 0;
+      while (copied < size && use_sendfile) {
+        auto chunk = std::min<uint64_t>(size - copied, 1 << 30);
+        ssize_t ret;
+        if (use_copy_file_range) {
+          ret = ::copy_file_range(in_fd, &in_offset, out_fd, &out_offset, chunk, 0);
+          if (ret < 0 && copied == 0 && (errno == EXDEV || errno == ENOSYS || errno == EOPNOTSUPP || errno == EINVAL)) {
+            use_copy_file_range = false;
+            continue;
+          }
+        }
+        else {
+          // sendfile() writes at the file position of out_fd.
+          if (::lseek(out_fd, out_offset, SEEK_SET) < 0) {
+            throw WriteException(_filename, "failed to seek");
+          }
+          ret = ::sendfile(out_fd, in_fd, &in_offset, chunk);
+          if (ret < 0 && copied == 0 && (errno == EINVAL || errno == ENOSYS)) {
+            use_sendfile = false;
+            continue;
+          }
+          if (ret > 0) {
+            out_offset += ret;
+          }
+        }
+        if (ret < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+          throw WriteException(_filename, "failed to copy");
+        }
+        if (ret == 0) {
+          throw ReadException(source._filename, "not enough remaining bytes at current offset");
+        }
+        copied += static_cast<uint64_t>(ret);
+      }
+      if (copied != 0) {
+        source._seek_file(source._file_offset_page_end + copied);
+        set_offset(_offset + copied);
+        _end_offset = std::max(_end_offset, _offset);
+        size -= copied;
+      }
+    }
+#endif
+    std::vector<std::byte> buffer(std::min<uint64_t>(size, 64 * 1024));
+    while (size != 0) {
+      auto chunk = std::min<uint64_t>(size, buffer.size());
+      source.read(buffer.data(), chunk);
+      write(buffer.data(), chunk);
+      size -= chunk;
+    }
+  }
+
+  // Finalizer from MurmurHash3. Keys are hashed with this before being
+  // inserted into or probed against a BloomBlock.
+  [[nodiscard]] constexpr uint64_t hash_key(
+    uint64_t key)
+  {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccd;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53;
+    key ^= key >> 33;
+    return key;
+  }
+
+  // One cache line of a blocked Bloom filter. A key sets exactly one bit in
+  // each of the eight words, so a probe touches a single cache line and is
+  // two 256-bit tests when AVX2 is available.
+  struct alignas(64) BloomBlock {
+    static constexpr uint32_t salts[8] = {
+      0x47b6137b, 0x44974d91, 0x8824ad5b, 0xa2b7289d,
+      0x705495c7, 0x2df1424b, 0x9efc4947, 0x5c6bfb31,
+    };
+
+    uint64_t words[8];
+
+    // Picks the block for a hash out of block_count blocks, which must be
+    // less than 2^32.
+    [[nodiscard]] static uint64_t select(
+      uint64_t hash,
+      uint64_t block_count)
+    {
+      return ((hash >> 32) * block_count) >> 32;
+    }
+
+    void insert(
+      uint64_t hash)
+    {
+      for (int i = 0; i < 8; ++i) {
+        words[i] |= _mask(hash, i);
+      }
+    }
+
+    [[nodiscard]] bool might_contain(
+      uint64_t hash) const
+    {
+#if defined(__AVX2__)
+      auto salt = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(salts));
+      auto bits = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_set1_epi32(static_cast<int>(hash)), salt), 26);
+      auto one = _mm256_set1_epi64x(1);
+      auto mask_lo = _mm256_sllv_epi64(one, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(bits)));
+      auto mask_hi = _mm256_sllv_epi64(one, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(bits, 1)));
+      auto block_lo = _mm256_load_si256(reinterpret_cast<__m256i const *>(words));
+      auto block_hi = _mm256_load_si256(reinterpret_cast<__m256i const *>(words + 4));
+      return _mm256_testc_si256(block_lo, mask_lo) && _mm256_testc_si256(block_hi, mask_hi);
+#else
+      uint64_t missing = 0;
+      for (int i = 0; i < 8; ++i) {
+        missing |= _mask(hash, i) & ~words[i];
+      }
+      return missing == 0;
+#endif
+    }
+
+  private:
+    [[nodiscard]] static uint64_t _mask(
+      uint64_t hash,
+      int i)
+    {
+      return uint64_t{1} << ((static_cast<uint32_t>(hash) * salts[i]) >> 26);
+    }
+  };
+
+  static_assert(sizeof(BloomBlock) == 64);
+
+  // A byte range of a file that can be decoded on its own.
+  struct FileSection {
+    uint64_t offset;
+    uint64_t size;
+  };
+
+  // Trailer written by RecordWriter::close(). The record offsets are stored
+  // relative to base_offset and bit-packed at bit_width bits each, so any
+  // record's offset can be computed without decoding its predecessors.
+  //
+  // When chunk_record_count is nonzero, every run of chunk_record_count
+  // records has bloom_block_count BloomBlocks at bloom_offset holding the
+  // hashes of the keys of those records.
+  struct RecordIndexFooter {
+    // Version 01 had no chunk or Bloom filter fields.
+    static constexpr uint64_t expected_magic = 0x3230584449525850; // "PXRIDX02"
+
+    uint64_t magic;
+    uint64_t record_count;
+    uint64_t base_offset;
+    uint64_t records_end;
+    uint64_t index_offset;
+    uint64_t bit_width;
+    uint64_t chunk_record_count;
+    uint64_t bloom_block_count;
+    uint64_t bloom_offset;
+  };
+
+  class RecordWriter {
+    Serializer *_serializer;
+    uint64_t _chunk_record_count;
+    uint64_t _bloom_block_count;
+    std::vector<uint64_t> _record_offsets;
+    std::vector<BloomBlock> _bloom_blocks;
+
+  public:
+    explicit RecordWriter(
+      Serializer &serializer)
+      : _serializer(&serializer)
+      , _chunk_record_count(0)
+      , _bloom_block_count(0)
+    {}
+
+    // Groups records into chunks of chunk_record_count records and keeps a
+    // Bloom filter of the keys of each chunk, sized for bloom_bits_per_key.
+    RecordWriter(
+      Serializer &serializer,
+      uint64_t chunk_record_count,
+      uint64_t bloom_bits_per_key = 10)
+      : _serializer(&serializer)
+      , _chunk_record_count(chunk_record_count)
+      , _bloom_block_count(std::max<uint64_t>(1, (chunk_record_count * bloom_bits_per_key + 511) / 512))
+    {
+      if (chunk_record_count == 0) {
+        throw Exception("record chunks must hold at least one record");
+      }
+    }
+
+    [[nodiscard]] uint64_t get_record_count() const
+    {
+      return _record_offsets.size();
+    }
+
+    // Marks the serializer's current offset as the start of the next record
+    // and returns that record's index.
+    uint64_t begin_record()
+    {
+      if (_chunk_record_count != 0 && _record_offsets.size() % _chunk_record_count == 0) {
+        _bloom_blocks.resize(_bloom_blocks.size() + _bloom_block_count, BloomBlock{});
+      }
+      _record_offsets.push_back(_serializer->get_offset());
+      return _record_offsets.size() - 1;
+    }
+
+    // Like begin_record(), and adds key to the Bloom filter of the record's
+    // chunk.
+    uint64_t begin_record(
+      uint64_t key)
+    {
+      if (_chunk_record_count == 0) {
+        throw Exception("record keys require a chunked RecordWriter");
+      }
+      auto index = begin_record();
+      auto hash = hash_key(key);
+      auto *chunk_blocks = _bloom_blocks.data() + _bloom_blocks.size() - _bloom_block_count;
+      chunk_blocks[BloomBlock::select(hash, _bloom_block_count)].insert(hash);
+      return index;
+    }
+
+    // Writes the offset index followed by a RecordIndexFooter. Nothing may be
+    // written to the serializer afterwards.
+    void close()
+    {
+      RecordIndexFooter footer{};
+      footer.magic = RecordIndexFooter::expected_magic;
+      footer.record_count = _record_offsets.size();
+      footer.records_end = _serializer->get_offset();
+      footer.base_offset = footer.records_end;
+      uint64_t max_delta = 0;
+      for (auto offset : _record_offsets) {
+        footer.base_offset = std::min(footer.base_offset, offset);
+      }
+      for (auto offset : _record_offsets) {
+        max_delta = std::max(max_delta, offset - footer.base_offset);
+      }
+      footer.bit_width = std::bit_width(max_delta);
+
+      std::vector<uint64_t> words((footer.record_count * footer.bit_width + 63) / 64, 0);
+      for (uint64_t i = 0; i < footer.record_count && footer.bit_width != 0; ++i) {
+        uint64_t value = _record_offsets[i] - footer.base_offset;
+        uint64_t bit = i * footer.bit_width;
+        uint64_t shift = bit % 64;
+        words[bit / 64] |= value << shift;
+        if (shift + footer.bit_width > 64) {
+          words[bit / 64 + 1] |= value >> (64 - shift);
+        }
+      }
+      uint64_t index_size = words.size() * sizeof(uint64_t);
+      if (index_size != 0) {
+        _serializer->write_aligned(words.data(), index_size, alignof(uint64_t));
+      }
+      footer.index_offset = _serializer->get_offset() - index_size;
+      footer.chunk_record_count = _chunk_record_count;
+      footer.bloom_block_count = _bloom_block_count;
+      if (!_bloom_blocks.empty()) {
+        _serializer->write_aligned(_bloom_blocks.data(), _bloom_blocks.size() * sizeof(BloomBlock), alignof(uint64_t));
+        footer.bloom_offset = _serializer->get_offset() - _bloom_blocks.size() * sizeof(BloomBlock);
+      }
+      _serializer->write_aligned(footer);
+    }
+  };
+
+  class RecordReader {
+    Deserializer *_deserializer;
+    RecordIndexFooter _footer;
+    std::vector<uint64_t> _index;
+    std::vector<BloomBlock> _bloom_blocks;
+
+  public:
+    explicit RecordReader(
+      Deserializer &deserializer)
+      : _deserializer(&deserializer)
+      , _footer{}
+    {
+      auto file_size = deserializer.get_file_size();
+      if (file_size < sizeof(RecordIndexFooter)) {
+        throw ReadException(deserializer.get_filename(), "missing record index footer");
+      }
+      deserializer.set_offset(file_size - sizeof(RecordIndexFooter));
+      deserializer.read(_footer);
+      _check_footer(file_size);
+      _index.resize(_get_index_word_count());
+      if (!_index.empty()) {
+        deserializer.set_offset(_footer.index_offset);
+        deserializer.read(reinterpret_cast<std::byte *>(_index.data()), _index.size() * sizeof(uint64_t));
+      }
+      if (_footer.chunk_record_count != 0) {
+        _bloom_blocks.resize(get_chunk_count() * _footer.bloom_block_count);
+        deserializer.set_offset(_footer.bloom_offset);
+        deserializer.read(reinterpret_cast<std::byte *>(_bloom_blocks.data()), _bloom_blocks.size() * sizeof(BloomBlock));
+      }
+    }
+
+    [[nodiscard]] uint64_t get_record_count() const
+    {
+      return _footer.record_count;
+    }
+
+    [[nodiscard]] uint64_t get_record_offset(
+      uint64_t index) const
+    {
+      _check_index(index);
+      auto width = _footer.bit_width;
+      if (width == 0) {
+        return _footer.base_offset;
+      }
+      uint64_t bit = index * width;
+      uint64_t shift = bit % 64;
+      uint64_t value = _index[bit / 64] >> shift;
+      if (shift + width > 64) {
+        value |= _index[bit / 64 + 1] << (64 - shift);
+      }
+      uint64_t mask = width == 64 ? ~uint64_t{0} : (uint64_t{1} << width) - 1;
+      if ((value & mask) > _footer.records_end - _footer.base_offset) {
+        throw ReadException(_deserializer->get_filename(), "invalid record offset: " + std::to_string(index));
+      }
+      return _footer.base_offset + (value & mask);
+    }
+
+    // Zero if the file was written without chunks.
+    [[nodiscard]] uint64_t get_chunk_record_count() const
+    {
+      return _footer.chunk_record_count;
+    }
+
+    [[nodiscard]] uint64_t get_chunk_count() const
+    {
+      if (_footer.chunk_record_count == 0) {
+        return 0;
+      }
+      return _footer.record_count / _footer.chunk_record_count + (_footer.record_count % _footer.chunk_record_count != 0 ? 1 : 0);
+    }
+
+    // False only if no record of the chunk was written with this key, so
+    // the chunk can be skipped without reading it. Always true for files
+    // without chunks.
+    [[nodiscard]] bool chunk_might_contain(
+      uint64_t chunk,
+      uint64_t key) const
+    {
+      if (_footer.chunk_record_count == 0) {
+        return true;
+      }
+      if (chunk >= get_chunk_count()) {
+        throw ReadException(_deserializer->get_filename(), "chunk index out of range: " + std::to_string(chunk));
+      }
+      auto hash = hash_key(key);
+      auto const *chunk_blocks = _bloom_blocks.data() + chunk * _footer.bloom_block_count;
+      return chunk_blocks[BloomBlock::select(hash, _footer.bloom_block_count)].might_contain(hash);
+    }
+
+    // Size of a record, assuming records were written back to back.
+    [[nodiscard]] uint64_t get_record_size(
+      uint64_t index) const
+    {
+      uint64_t end = index + 1 < _footer.record_count ? get_record_offset(index + 1) : _footer.records_end;
+      return end - get_record_offset(index);
+    }
+
+    // Every record as a section, for parallel_for_each_section().
+    [[nodiscard]] std::vector<FileSection> get_sections() const
+    {
+      std::vector<FileSection> sections;
+      sections.reserve(_footer.record_count);
+      for (uint64_t i = 0; i < _footer.record_count; ++i) {
+        sections.push_back(FileSection{get_record_offset(i), get_record_size(i)});
+      }
+      return sections;
+    }
+
+    // Positions the deserializer at the start of the given record.
+    void seek_record(
+      uint64_t index)
+    {
+      _deserializer->set_offset(get_record_offset(index));
+    }
+
+  private:
+    void _check_index(
+      uint64_t index) const
+    {
+      if (index >= _footer.record_count) {
+        throw ReadException(_deserializer->get_filename(), "record index out of range: " + std::to_string(index));
+      }
+    }
+
+    // Rejects a footer that places the records, the index or the Bloom
+    // filters outside the file, so that a corrupt one cannot size them past
+    // what the file holds.
+    void _check_footer(
+      uint64_t file_size) const
+    {
+      uint64_t footer_offset = file_size - sizeof(RecordIndexFooter);
+      bool valid = _footer.magic == RecordIndexFooter::expected_magic
+        && _footer.bit_width <= 64
+        && _footer.base_offset <= _footer.records_end
+        && _footer.records_end <= _footer.index_offset
+        && _footer.index_offset <= footer_offset
+        && _get_index_word_count() <= (footer_offset - _footer.index_offset) / sizeof(uint64_t);
+      uint64_t chunk_count = get_chunk_count();
+      if (valid && chunk_count != 0) {
+        uint64_t index_end = _footer.index_offset + _get_index_word_count() * sizeof(uint64_t);
+        valid = _footer.bloom_block_count != 0
+          && _footer.bloom_block_count < (uint64_t{1} << 32)
+          && _footer.bloom_offset >= index_end
+          && _footer.bloom_offset <= footer_offset
+          && _footer.bloom_block_count <= (footer_offset - _footer.bloom_offset) / sizeof(BloomBlock) / chunk_count;
+      }
+      if (!valid) {
+        throw ReadException(_deserializer->get_filename(), "invalid record index footer");
+      }
+    }
+
+    // Number of words of the bit-packed index, or UINT64_MAX if that
+    // overflows.
+    [[nodiscard]] uint64_t _get_index_word_count() const
+    {
+      if (_footer.bit_width != 0 && _footer.record_count > UINT64_MAX / _footer.bit_width) {
+        return UINT64_MAX;
+      }
+      uint64_t bits = _footer.record_count * _footer.bit_width;
+      return bits / 64 + (bits % 64 != 0 ? 1 : 0);
+    }
+  };
+
+  // Copies count values of Size bytes, found every stride bytes starting at
+  // src, into dest back to back. This is the field gather behind
+  // ColumnWriter. With AVX2, 1, 2, 4 and 8 byte values are gathered eight
+  // (four for 8 bytes) at a time; every other size, and the tail, is copied
+  // one value at a time.
+  template <uint64_t Size>
+  void gather_strided(
+    std::byte const *src,
+    uint64_t stride,
+    uint64_t count,
+    std::byte *dest)
+  {
+    uint64_t i = 0;
+#if defined(__AVX2__)
+    if (stride <= INT32_MAX / 8) {
+      auto s = static_cast<int>(stride);
+      if constexpr (Size == 8) {
+        auto index = _mm_setr_epi32(0, s, 2 * s, 3 * s);
+        for (; i + 4 <= count; i += 4) {
+          auto values = _mm256_i32gather_epi64(reinterpret_cast<long long const *>(src + i * stride), index, 1);
+          _mm256_storeu_si256(reinterpret_cast<__m256i *>(dest + i * Size), values);
+        }
+      }
+      else if constexpr (Size == 4 || Size == 2 || Size == 1) {
+        auto index = _mm256_setr_epi32(0, s, 2 * s, 3 * s, 4 * s, 5 * s, 6 * s, 7 * s);
+        // Each lane loads 4 bytes, so for narrower values the last lanes of
+        // a batch must be at least 3 values away from the end of src.
+        uint64_t slack = Size == 4 ? 0 : 3;
+        for (; i + 8 + slack <= count; i += 8) {
+          auto values = _mm256_i32gather_epi32(reinterpret_cast<int const *>(src + i * stride), index, 1);
+          if constexpr (Size == 4) {
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(dest + i * Size), values);
+          }
+          else {
+            auto pack = Size == 2
+              ? _mm256_setr_epi8(0, 1, 4, 5, 8, 9, 12, 13, -1, -1, -1, -1, -1, -1, -1, -1, 0, 1, 4, 5, 8, 9, 12, 13, -1, -1, -1, -1, -1, -1, -1, -1)
+              : _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+            auto packed = _mm256_shuffle_epi8(values, pack);
+            auto lo = _mm256_castsi256_si128(packed);
+            auto hi = _mm256_extracti128_si256(packed, 1);
+            if constexpr (Size == 2) {
+              _mm_storeu_si128(reinterpret_cast<__m128i *>(dest + i * Size), _mm_unpacklo_epi64(lo, hi));
+            }
+            else {
+              _mm_storel_epi64(reinterpret_cast<__m128i *>(dest + i * Size), _mm_unpacklo_epi32(lo, hi));
+            }
+          }
+        }
+      }
+    }
+#endif
+    for (; i < count; ++i) {
+      std::memcpy(dest + i * Size, src + i * stride, Size);
+    }
+  }
+
+  struct ColumnTableHeader {
+    static constexpr uint64_t expected_magic = 0x3130424154435850; // "PXCTAB01"
+
+    uint64_t magic;
+    uint64_t row_count;
+    uint64_t column_count;
+  };
+
+  struct ColumnDescriptor {
+    uint64_t offset;
+    uint64_t element_size;
+  };
+
+  // Writes vectors of records as a table of columns: a ColumnTableHeader,
+  // one ColumnDescriptor per column, then each column's values back to back,
+  // so that readers can load only the fields they need.
+  class ColumnWriter {
+    static constexpr uint64_t _column_alignment = 64;
+    static constexpr uint64_t _staging_size = 64 * 1024;
+
+    Serializer *_serializer;
+    std::vector<std::byte> _staging;
+
+  public:
+    explicit ColumnWriter(
+      Serializer &serializer)
+      : _serializer(&serializer)
+      , _staging(_staging_size)
+    {}
+
+    // Writes one column per field, in the order given, and returns the
+    // offset of the table for ColumnReader.
+    template <typename Record, typename... Fields>
+    uint64_t write(
+      std::span<Record const> records,
+      Fields Record::*...fields)
+    {
+      static_assert(sizeof...(Fields) > 0);
+      static_assert((std::is_pod_v<Fields> && ...));
+      ColumnTableHeader header{ColumnTableHeader::expected_magic, records.size(), sizeof...(Fields)};
+      _serializer->write_aligned(header);
+      uint64_t table_offset = _serializer->get_offset() - sizeof(ColumnTableHeader);
+
+      ColumnDescriptor descriptors[] = {ColumnDescriptor{0, sizeof(Fields)}...};
+      uint64_t offset = _serializer->get_offset() + sizeof(descriptors);
+      for (auto &descriptor : descriptors) {
+        offset = (offset + _column_alignment - 1) / _column_alignment * _column_alignment;
+        descriptor.offset = offset;
+        offset += descriptor.element_size * records.size();
+      }
+      _serializer->write(descriptors, sizeof(descriptors));
+      (_write_column(records, fields), ...);
+      return table_offset;
+    }
+
+  private:
+    template <typename Record, typename Field>
+    void _write_column(
+      std::span<Record const> records,
+      Field Record::*field)
+    {
+      uint64_t rows_per_batch = _staging_size / sizeof(Field);
+      uint64_t row = 0;
+      do {
+        uint64_t count = std::min<uint64_t>(rows_per_batch, records.size() - row);
+        auto *dest = _staging.data();
+        if (count != 0) {
+          auto const *src = reinterpret_cast<std::byte const *>(&(records[row].*field));
+          gather_strided<sizeof(Field)>(src, sizeof(Record), count, dest);
+        }
+        if (row == 0) {
+          _serializer->write_aligned(dest, count * sizeof(Field), _column_alignment);
+        }
+        else {
+          _serializer->write(dest, count * sizeof(Field));
+        }
+        row += count;
+      } while (row < records.size());
+    }
+  };
+
+  class ColumnReader {
+    static constexpr uint64_t _staging_size = 64 * 1024;
+
+    Deserializer *_deserializer;
+    ColumnTableHeader _header;
+    std::vector<ColumnDescriptor> _descriptors;
+
+  public:
+    ColumnReader(
+      Deserializer &deserializer,
+      uint64_t table_offset)
+      : _deserializer(&deserializer)
+      , _header{}
+    {
+      deserializer.set_offset(table_offset);
+      deserializer.read(_header);
+      if (_header.magic != ColumnTableHeader::expected_magic) {
+        throw ReadException(deserializer.get_filename(), "invalid column table header");
+      }
+      deserializer.check_remaining(_header.column_count, sizeof(ColumnDescriptor));
+      _descriptors.resize(_header.column_count);
+      if (!_descriptors.empty()) {
+        deserializer.read(reinterpret_cast<std::byte *>(_descriptors.data()), _descriptors.size() * sizeof(ColumnDescriptor));
+      }
+      auto file_size = deserializer.get_file_size();
+      for (auto const &descriptor : _descriptors) {
+        if (descriptor.element_size == 0) {
+          throw ReadException(deserializer.get_filename(), "invalid column descriptor");
+        }
+        // An empty column may be placed past the end of the file.
+        if (_header.row_count != 0
+          && (descriptor.offset > file_size || _header.row_count > (file_size - descriptor.offset) / descriptor.element_size)) {
+          throw ReadException(deserializer.get_filename(), "invalid column descriptor");
+        }
+      }
+    }
+
+    [[nodiscard]] uint64_t get_row_count() const
+    {
+      return _header.row_count;
+    }
+
+    [[nodiscard]] uint64_t get_column_count() const
+    {
+      return _header.column_count;
+    }
+
+    // Reads a whole column into dest, which must hold get_row_count()
+    // elements. No other column is read.
+    template <typename T>
+    void read_column(
+      uint64_t column,
+      std::span<T> dest)
+    {
+      static_assert(std::is_pod_v<T>);
+      _seek_column(column, sizeof(T), dest.size());
+      if (!dest.empty()) {
+        _deserializer->read(reinterpret_cast<std::byte *>(dest.data()), dest.size_bytes());
+      }
+    }
+
+    template <typename T>
+    [[nodiscard]] std::vector<T> read_column(
+      uint64_t column)
+    {
+      _check_column(column, sizeof(T));
+      std::vector<T> values(_header.row_count);
+      read_column(column, std::span<T>(values));
+      return values;
+    }
+
+    // Reads a column straight into one field of each record, leaving the
+    // other fields untouched.
+    template <typename Record, typename Field>
+    void read_column(
+      uint64_t column,
+      std::span<Record> records,
+      Field Record::*field)
+    {
+      static_assert(std::is_pod_v<Field>);
+      _seek_column(column, sizeof(Field), records.size());
+      std::byte staging[_staging_size];
+      uint64_t rows_per_batch = _staging_size / sizeof(Field);
+      for (uint64_t row = 0; row < records.size(); row += rows_per_batch) {
+        uint64_t count = std::min<uint64_t>(rows_per_batch, records.size() - row);
+        _deserializer->read(staging, count * sizeof(Field));
+        for (uint64_t i = 0; i < count; ++i) {
+          std::memcpy(&(records[row + i].*field), staging + i * sizeof(Field), sizeof(Field));
+        }
+      }
+    }
+
+  private:
+    void _check_column(
+      uint64_t column,
+      uint64_t element_size) const
+    {
+      if (column >= _descriptors.size()) {
+        throw ReadException(_deserializer->get_filename(), "column index out of range: " + std::to_string(column));
+      }
+      if (_descriptors[column].element_size != element_size) {
+        throw ReadException(_deserializer->get_filename(), "column " + std::to_string(column) + " does not match destination");
+      }
+    }
+
+    void _seek_column(
+      uint64_t column,
+      uint64_t element_size,
+      uint64_t row_count)
+    {
+      _check_column(column, element_size);
+      if (row_count != _header.row_count) {
+        throw ReadException(_deserializer->get_filename(), "column " + std::to_string(column) + " does not match destination");
+      }
+      _deserializer->set_offset(_descriptors[column].offset);
+    }
+  };
+
+  // Writes fields of 0 to 64 bits, least significant bit first, to a
+  // Serializer. Fields are packed into a 64-bit accumulator that is written
+  // out as a native-endian word whenever it fills up, so the stream is
+  // always a whole number of words; flush() pads the last word with zero
+  // bits.
+  class BitWriter {
+    Serializer *_serializer;
+    uint64_t _bits;
+    uint64_t _bit_count;
+
+  public:
+    explicit BitWriter(
+      Serializer &serializer)
+      : _serializer(&serializer)
+      , _bits(0)
+      , _bit_count(0)
+    {}
+
+    // Writes the low count bits of value.
+    void write_bits(
+      uint64_t value,
+      uint64_t count)
+    {
+      value = _low_bits(value, count);
+      _bits |= value << _bit_count;
+      uint64_t total = _bit_count + count;
+      if (total >= 64) {
+        _serializer->write(_bits);
+        _bits = _bit_count == 0 ? 0 : value >> (64 - _bit_count);
+        total -= 64;
+      }
+      _bit_count = total;
+    }
+
+    void flush()
+    {
+      if (_bit_count != 0) {
+        _serializer->write(_bits);
+        _bits = 0;
+        _bit_count = 0;
+      }
+    }
+
+  private:
+    [[nodiscard]] static uint64_t _low_bits(
+      uint64_t value,
+      uint64_t count)
+    {
+      return count >= 64 ? value : value & ((uint64_t{1} << count) - 1);
+    }
+  };
+
+  // Reads fields written by BitWriter from a Deserializer, refilling a
+  // 64-bit accumulator a word at a time. Reading the same fields that were
+  // written leaves the deserializer just past the writer's last word.
+  class BitReader {
+    Deserializer *_deserializer;
+    uint64_t _bits;
+    uint64_t _bit_count;
+
+  public:
+    explicit BitReader(
+      Deserializer &deserializer)
+      : _deserializer(&deserializer)
+      , _bits(0)
+      , _bit_count(0)
+    {}
+
+    // Reads count bits, count being at most 64.
+    [[nodiscard]] uint64_t read_bits(
+      uint64_t count)
+    {
+      if (count <= _bit_count) {
+        uint64_t value = _low_bits(_bits, count);
+        _bits = _shift_right(_bits, count);
+        _bit_count -= count;
+        return value;
+      }
+      uint64_t value = _bits;
+      uint64_t have = _bit_count;
+      _deserializer->read(_bits);
+      uint64_t rest = count - have;
+      value |= _low_bits(_bits, rest) << have;
+      _bits = _shift_right(_bits, rest);
+      _bit_count = 64 - rest;
+      return value;
+    }
+
+  private:
+    [[nodiscard]] static uint64_t _low_bits(
+      uint64_t value,
+      uint64_t count)
+    {
+      return count >= 64 ? value : value & ((uint64_t{1} << count) - 1);
+    }
+
+    [[nodiscard]] static uint64_t _shift_right(
+      uint64_t value,
+      uint64_t count)
+    {
+      return count >= 64 ? 0 : value >> count;
+    }
+  };
+
+  // Writes values compressed as in Facebook's Gorilla: each value is XORed
+  // with its predecessor, and only the bits between the leading and trailing
+  // zeroes of the result are kept. Slowly changing series compress to a few
+  // bits per value.
+  inline void write_f64_series(
+    Serializer &serializer,
+    std::span<double const> values)
+  {
+    serializer.write(static_cast<uint64_t>(values.size()));
+    if (values.empty()) {
+      return;
+    }
+    serializer.write(values[0]);
+    BitWriter bits(serializer);
+    auto previous = std::bit_cast<uint64_t>(values[0]);
+    uint64_t window_leading = 64;
+    uint64_t window_trailing = 64;
+    for (size_t i = 1; i < values.size(); ++i) {
+      auto current = std::bit_cast<uint64_t>(values[i]);
+      auto delta = current ^ previous;
+      previous = current;
+      if (delta == 0) {
+        bits.write_bits(0, 1);
+        continue;
+      }
+      uint64_t leading = std::min(std::countl_zero(delta), 31);
+      uint64_t trailing = std::countr_zero(delta);
+      if (window_leading <= leading && window_trailing <= trailing) {
+        bits.write_bits(0b01, 2);
+        bits.write_bits(delta >> window_trailing, 64 - window_leading - window_trailing);
+        continue;
+      }
+      uint64_t meaningful = 64 - leading - trailing;
+      bits.write_bits(0b11, 2);
+      bits.write_bits(leading, 5);
+      bits.write_bits(meaningful - 1, 6);
+      bits.write_bits(delta >> trailing, meaningful);
+      window_leading = leading;
+      window_trailing = trailing;
+    }
+    bits.flush();
+  }
+
+  [[nodiscard]] inline std::vector<double> read_f64_series(
+    Deserializer &deserializer)
+  {
+    uint64_t count;
+    deserializer.read(count);
+    if (count == 0) {
+      return {};
+    }
+    // The first value takes 8 bytes and every other one at least a bit.
+    deserializer.check_remaining(8 + (count - 1) / 8);
+    std::vector<double> values(count);
+    deserializer.read(values[0]);
+    BitReader bits(deserializer);
+    auto previous = std::bit_cast<uint64_t>(values[0]);
+    uint64_t window_trailing = 0;
+    uint64_t window_meaningful = 0;
+    for (uint64_t i = 1; i < count; ++i) {
+      if (bits.read_bits(1) != 0) {
+        if (bits.read_bits(1) != 0) {
+          uint64_t leading = bits.read_bits(5);
+          window_meaningful = bits.read_bits(6) + 1;
+          window_trailing = 64 - leading - window_meaningful;
+        }
+        previous ^= bits.read_bits(window_meaningful) << window_trailing;
+      }
+      values[i] = std::bit_cast<double>(previous);
+    }
+    return values;
+  }
+
+  // Returns how many of the size bytes at data, which must be at least one,
+  // equal data[0]. Compares 32 bytes at a time with AVX2, 16 with SSE2.
+  [[nodiscard]] inline uint64_t count_run(
+    uint8_t const *data,
+    uint64_t size)
+  {
+    uint8_t value = data[0];
+    uint64_t i = 0;
+#if defined(__AVX2__)
+    auto wanted = _mm256_set1_epi8(static_cast<char>(value));
+    for (; i + 32 <= size; i += 32) {
+      auto chunk = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(data + i));
+      auto equal = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, wanted)));
+      if (equal != 0xffffffff) {
+        return i + std::countr_one(equal);
+      }
+    }
+#elif defined(__SSE2__)
+    auto wanted = _mm_set1_epi8(static_cast<char>(value));
+    for (; i + 16 <= size; i += 16) {
+      auto chunk = _mm_loadu_si128(reinterpret_cast<__m128i const *>(data + i));
+      auto equal = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, wanted)));
+      if (equal != 0xffff) {
+        return i + std::countr_one(equal);
+      }
+    }
+#endif
+    while (i < size && data[i] == value) {
+      ++i;
+    }
+    return i;
+  }
+
+  // Writes an array of bytes or bools as a varint count followed by
+  // (value byte, varint run length) pairs.
+  template <typename T>
+  void write_rle(
+    Serializer &serializer,
+    std::span<T const> values)
+  {
+    static_assert(std::is_same_v<T, uint8_t> || std::is_same_v<T, bool>);
+    static_assert(sizeof(T) == 1);
+    auto const *bytes = reinterpret_cast<uint8_t const *>(values.data());
+    serializer.write_varint(values.size());
+    uint64_t i = 0;
+    while (i < values.size()) {
+      auto run = count_run(bytes + i, values.size() - i);
+      serializer.write(bytes[i]);
+      serializer.write_varint(run);
+      i += run;
+    }
+  }
+
+  // Reads an array written by write_rle into dest, whose size must match the
+  // stored count. Runs are expanded with memset.
+  template <typename T>
+  void read_rle(
+    Deserializer &deserializer,
+    std::span<T> dest)
+  {
+    static_assert(std::is_same_v<T, uint8_t> || std::is_same_v<T, bool>);
+    if (deserializer.read_varint() != dest.size()) {
+      throw ReadException(deserializer.get_filename(), "run-length array does not match destination");
+    }
+    auto *bytes = reinterpret_cast<uint8_t *>(dest.data());
+    uint64_t i = 0;
+    while (i < dest.size()) {
+      uint8_t value;
+      deserializer.read(value);
+      auto run = deserializer.read_varint();
+      if (run == 0 || run > dest.size() - i) {
+        throw ReadException(deserializer.get_filename(), "invalid run length");
+      }
+      if (std::is_same_v<T, bool> && value > 1) {
+        throw ReadException(deserializer.get_filename(), "invalid boolean in run-length array");
+      }
+      std::memset(bytes + i, value, run);
+      i += run;
+    }
+  }
+
+  // The stored count is not trusted to size the vector, which instead grows
+  // by each run read. Every run takes at least two bytes of the file.
+  [[nodiscard]] inline std::vector<uint8_t> read_rle(
+    Deserializer &deserializer)
+  {
+    uint64_t count = deserializer.read_varint();
+    std::vector<uint8_t> values;
+    while (values.size() < count) {
+      deserializer.check_remaining(2);
+      uint8_t value;
+      deserializer.read(value);
+      auto run = deserializer.read_varint();
+      if (run == 0 || run > count - values.size()) {
+        throw ReadException(deserializer.get_filename(), "invalid run length");
+      }
+      values.resize(values.size() + run, value);
+    }
+    return values;
+  }
+
+  // CRC-32C (Castagnoli), the checksum of framed log records. Uses the SSE4.2
+  // crc32 instruction when available and a byte-wise table otherwise.
+  [[nodiscard]] inline uint32_t crc32c(
+    void const *data,
+    uint64_t size,
+    uint32_t crc = 0)
+  {
+    auto const *bytes = static_cast<uint8_t const *>(data);
+    crc = ~crc;
+#if defined(__SSE4_2__) && defined(__x86_64__)
+    uint64_t crc64 = crc;
+    for (; size >= 8; size -= 8, bytes += 8) {
+      uint64_t word;
+      std::memcpy(&word, bytes, 8);
+      crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = static_cast<uint32_t>(crc64);
+    for (; size > 0; --size, ++bytes) {
+      crc = _mm_crc32_u8(crc, *bytes);
+    }
+#else
+    static constexpr auto table = [] {
+      std::array<uint32_t, 256> entries{};
+      for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t entry = i;
+        for (int bit = 0; bit < 8; ++bit) {
+          entry = (entry >> 1) ^ (0x82f63b78 & (0 - (entry & 1)));
+        }
+        entries[i] = entry;
+      }
+      return entries;
+    }();
+    for (; size > 0; --size, ++bytes) {
+      crc = table[(crc ^ *bytes) & 0xff] ^ (crc >> 8);
+    }
+#endif
+    return ~crc;
+  }
+
+  // Precedes every record in a log. The checksum covers the size and the
+  // payload, so a torn or corrupted length is detected as well.
+  struct LogRecordHeader {
+    uint32_t size;
+    uint32_t checksum;
+
+    [[nodiscard]] static uint32_t compute_checksum(
+      void const *data,
+      uint32_t size)
+    {
+      return crc32c(data, size, crc32c(&size, sizeof(size)));
+    }
+  };
+
+  // A log is divided into blocks of block_size bytes, each starting with this
+  // header. Records run across block boundaries, skipping the headers. Each
+  // header holds the checksum of the whole previous block, header included,
+  // so recovery can validate complete blocks with one checksum each and only
+  // has to walk the records of the last block that checks out.
+  struct LogBlockHeader {
+    static constexpr uint64_t block_size = 32 * 1024;
+
+    uint64_t block_index;
+    // Number of records in the log before first_record.
+    uint64_t record_count;
+    // Offset within the block of the first record starting in it, or 0 if a
+    // single record covers the whole block.
+    uint32_t first_record;
+    // Checksum of the whole previous block, or 0 for the first block.
+    uint32_t previous_block_checksum;
+    uint32_t checksum;
+    uint32_t reserved;
+
+    [[nodiscard]] uint32_t compute_checksum() const
+    {
+      return crc32c(this, offsetof(LogBlockHeader, checksum), 0x504c4f47);
+    }
+
+    [[nodiscard]] bool is_valid(
+      uint64_t index) const
+    {
+      return block_index == index && checksum == compute_checksum();
+    }
+  };
+  static_assert(sizeof(LogBlockHeader) == 32);
+
+  // Reads the records of a log written by LogSerializer, validating each
+  // against its checksum. Reading stops at the first record that is torn
+  // (extends past the end of the file) or corrupt, which after a crash marks
+  // the end of what was durably written.
+  class LogReader {
+    Deserializer *_deserializer;
+    uint64_t _file_size;
+    uint64_t _valid_end;
+    uint64_t _record_count;
+
+  public:
+    // Starts reading at offset, which must be the start of a record, such as
+    // 0 or a block's first_record. record_count is the number of records
+    // before it.
+    explicit LogReader(
+      Deserializer &deserializer,
+      uint64_t offset = 0,
+      uint64_t record_count = 0)
+      : _deserializer(&deserializer)
+      , _file_size(deserializer.get_file_size())
+      , _valid_end(offset)
+      , _record_count(record_count)
+    {}
+
+    // Reads the next valid record into payload. Returns false, leaving
+    // payload unspecified, once the valid part of the log is exhausted.
+    [[nodiscard]] bool read_record(
+      std::vector<std::byte> &payload)
+    {
+      uint64_t offset = _valid_end;
+      LogRecordHeader header;
+      if (!_read(&header, sizeof(header), offset)) {
+        return false;
+      }
+      if (header.size > _file_size - offset) {
+        return false;
+      }
+      payload.resize(header.size);
+      if (!_read(payload.data(), header.size, offset)) {
+        return false;
+      }
+      if (LogRecordHeader::compute_checksum(payload.data(), header.size) != header.checksum) {
+        return false;
+      }
+      _valid_end = offset;
+      ++_record_count;
+      return true;
+    }
+
+    // Offset just past the last valid record read.
+    [[nodiscard]] uint64_t get_valid_end() const
+    {
+      return _valid_end;
+    }
+
+    [[nodiscard]] uint64_t get_record_count() const
+    {
+      return _record_count;
+    }
+
+  private:
+    // Reads size bytes of record data starting at offset, skipping and
+    // validating the block headers in between.
+    [[nodiscard]] bool _read(
+      void *data,
+      uint64_t size,
+      uint64_t &offset)
+    {
+      auto *bytes = static_cast<std::byte *>(data);
+      while (size != 0) {
+        uint64_t block_offset = offset % LogBlockHeader::block_size;
+        if (block_offset == 0) {
+          if (_file_size - offset < sizeof(LogBlockHeader)) {
+            return false;
+          }
+          LogBlockHeader block;
+          _deserializer->set_offset(offset);
+          _deserializer->read(block);
+          if (!block.is_valid(offset / LogBlockHeader::block_size)) {
+            return false;
+          }
+          offset += sizeof(LogBlockHeader);
+          continue;
+        }
+        uint64_t count = std::min(size, LogBlockHeader::block_size - block_offset);
+        if (_file_size - offset < count) {
+          return false;
+        }
+        _deserializer->set_offset(offset);
+        _deserializer->read(bytes, count);
+        bytes += count;
+        size -= count;
+        offset += count;
+      }
+      return true;
+    }
+  };
+
+  // End of the valid part of a log.
+  struct LogTail {
+    uint64_t valid_end;
+    uint64_t record_count;
+  };
+
+  // Finds the end of the valid part of a log. The complete blocks are
+  // checked against the checksum in the following block's header, which
+  // covers the previous header in turn, so every block before the first one
+  // that fails is intact. The records are then only walked from the one
+  // holding the start of that block's data.
+  [[nodiscard]] inline LogTail find_log_tail(
+    Deserializer &deserializer)
+  {
+    uint64_t file_size = deserializer.get_file_size();
+    auto read_block = [&](uint64_t index, LogBlockHeader &block) {
+      uint64_t offset = index * LogBlockHeader::block_size;
+      if (file_size - offset < sizeof(LogBlockHeader)) {
+        return false;
+      }
+      deserializer.set_offset(offset);
+      deserializer.read(block);
+      return block.is_valid(index);
+    };
+    LogBlockHeader block;
+    if (file_size == 0 || !read_block(0, block)) {
+      return LogTail{0, 0};
+    }
+    std::vector<std::byte> contents(LogBlockHeader::block_size);
+    uint64_t index = 0;
+    while ((index + 1) * LogBlockHeader::block_size < file_size) {
+      deserializer.set_offset(index * LogBlockHeader::block_size);
+      deserializer.read(contents.data(), contents.size());
+      if (!read_block(index + 1, block) || block.previous_block_checksum != crc32c(contents.data(), contents.size())) {
+        break;
+      }
+      ++index;
+    }
+    // Start at the record holding the first data of that block, which may
+    // begin in an earlier block. Block 0 always starts with a record.
+    read_block(index, block);
+    if (block.first_record != sizeof(LogBlockHeader)) {
+      do {
+        --index;
+        read_block(index, block);
+      } while (block.first_record == 0);
+    }
+    LogReader reader(deserializer, index * LogBlockHeader::block_size + block.first_record, block.record_count);
+    std::vector<std::byte> payload;
+    while (reader.read_record(payload)) {
+    }
+    // A block header with no record data after it is part of a torn tail.
+    uint64_t valid_end = reader.get_valid_end();
+    if (valid_end % LogBlockHeader::block_size == sizeof(LogBlockHeader)) {
+      valid_end -= sizeof(LogBlockHeader);
+    }
+    return LogTail{valid_end, reader.get_record_count()};
+  }
+
+  // Appends framed records to a log file from any number of threads and
+  // makes them durable with group commit: a thread that needs its records
+  // on disk either syncs the file itself, covering every record appended so
+  // far, or waits for a sync already in progress to cover it. One
+  // fdatasync() therefore serves all the appenders that arrive while the
+  // previous one runs.
+  class LogSerializer {
+    Serializer _serializer;
+    std::chrono::microseconds _max_group_delay;
+    std::mutex _mutex;
+    std::condition_variable _synced;
+    uint64_t _synced_offset;
+    uint64_t _record_count;
+    // Checksum of the current block up to the end of the log.
+    uint32_t _block_checksum;
+    bool _syncing;
+
+  public:
+    // Opens the log for appending. An existing log must end with a valid
+    // record; run recover_log() on it first after a crash. A thread that
+    // starts a sync first sleeps for the full max_group_delay, so that
+    // records appended meanwhile by other threads are synced in the same
+    // group.
+    LogSerializer(
+      DestructorExceptions &exceptions,
+      char const *filename,
+      std::chrono::microseconds max_group_delay = std::chrono::microseconds(0))
+      : _serializer(exceptions, filename, SerializerOptions{.append = true})
+      , _max_group_delay(max_group_delay)
+      , _synced_offset(_serializer.get_offset())
+      , _record_count(0)
+      , _block_checksum(0)
+      , _syncing(false)
+    {
+      if (_synced_offset != 0) {
+        Deserializer deserializer(exceptions, filename, LogBlockHeader::block_size);
+        auto tail = find_log_tail(deserializer);
+        if (tail.valid_end != _synced_offset) {
+          throw WriteException(filename, "log has an invalid tail");
+        }
+        _record_count = tail.record_count;
+        uint64_t block_offset = (_synced_offset - 1) / LogBlockHeader::block_size * LogBlockHeader::block_size;
+        std::vector<std::byte> contents(_synced_offset - block_offset);
+        deserializer.set_offset(block_offset);
+        deserializer.read(contents.data(), contents.size());
+        _block_checksum = crc32c(contents.data(), contents.size());
+      }
+    }
+
+    LogSerializer(LogSerializer const &) = delete;
+    LogSerializer &operator=(LogSerializer const &) = delete;
+
+    // Appends a record and returns the offset just past it, to be passed to
+    // sync(). The record is not durable until then.
+    uint64_t append(
+      void const *data,
+      uint64_t size)
+    {
+      if (size > UINT32_MAX) {
+        throw WriteException(_serializer.get_filename(), "log record too large");
+      }
+      LogRecordHeader header{static_cast<uint32_t>(size), LogRecordHeader::compute_checksum(data, static_cast<uint32_t>(size))};
+      std::lock_guard<std::mutex> lock(_mutex);
+      uint64_t record_size = sizeof(header) + size;
+      uint64_t remaining = record_size;
+      _write_record_data(&header, sizeof(header), record_size, remaining);
+      _write_record_data(data, size, record_size, remaining);
+      ++_record_count;
+      return _serializer.get_offset();
+    }
+
+    // Returns once every record ending at or before end_offset is on disk.
+    void sync(
+      uint64_t end_offset)
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      while (_synced_offset < end_offset) {
+        if (_syncing) {
+          _synced.wait(lock);
+          continue;
+        }
+        _syncing = true;
+        if (_max_group_delay.count() > 0) {
+          lock.unlock();
+          std::this_thread::sleep_for(_max_group_delay);
+          lock.lock();
+        }
+        uint64_t target = _serializer.get_offset();
+        try {
+          _serializer.flush();
+        }
+        catch (...) {
+          _syncing = false;
+          _synced.notify_all();
+          throw;
+        }
+        lock.unlock();
+        auto synced = _sync_file();
+        lock.lock();
+        _syncing = false;
+        if (synced) {
+          _synced_offset = std::max(_synced_offset, target);
+        }
+        _synced.notify_all();
+        if (!synced) {
+          throw WriteException(_serializer.get_filename(), "failed to sync");
+        }
+      }
+    }
+
+    // Makes every record appended so far durable.
+    void sync()
+    {
+      uint64_t end_offset;
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        end_offset = _serializer.get_offset();
+      }
+      sync(end_offset);
+    }
+
+    uint64_t append_durable(
+      void const *data,
+      uint64_t size)
+    {
+      auto end_offset = append(data, size);
+      sync(end_offset);
+      return end_offset;
+    }
+
+  private:
+    // Writes part of the current record, of which remaining bytes are still
+    // to be written, starting a new block wherever it crosses a boundary.
+    void _write_record_data(
+      void const *data,
+      uint64_t size,
+      uint64_t record_size,
+      uint64_t &remaining)
+    {
+      auto const *bytes = static_cast<std::byte const *>(data);
+      while (size != 0) {
+        uint64_t offset = _serializer.get_offset();
+        uint64_t block_offset = offset % LogBlockHeader::block_size;
+        if (block_offset == 0) {
+          _write_block_header(offset / LogBlockHeader::block_size, remaining != record_size, remaining);
+          continue;
+        }
+        uint64_t count = std::min(size, LogBlockHeader::block_size - block_offset);
+        _serializer.write(bytes, count);
+        _block_checksum = crc32c(bytes, count, _block_checksum);
+        bytes += count;
+        size -= count;
+        remaining -= count;
+      }
+    }
+
+    void _write_block_header(
+      uint64_t index,
+      bool in_record,
+      uint64_t remaining)
+    {
+      LogBlockHeader block{index, _record_count, sizeof(LogBlockHeader), index == 0 ? 0 : _block_checksum, 0, 0};
+      if (in_record) {
+        // The current record continues into this block; the next one starts
+        // after it, unless it fills the block.
+        uint64_t record_end = sizeof(LogBlockHeader) + remaining;
+        block.record_count = _record_count + 1;
+        block.first_record = record_end < LogBlockHeader::block_size ? static_cast<uint32_t>(record_end) : 0;
+      }
+      block.checksum = block.compute_checksum();
+      _serializer.write(block);
+      _block_checksum = crc32c(&block, sizeof(block));
+    }
+
+    [[nodiscard]] bool _sync_file()
+    {
+#if defined(PICKAXE_POSIX)
+#if defined(__APPLE__)
+      return ::fsync(_serializer.get_file_descriptor()) == 0;
+#else
+      return ::fdatasync(_serializer.get_file_descriptor()) == 0;
+#endif
+#else
+      return true;
+#endif
+    }
+  };
+
+  // Truncates a log after its last valid record, so that a LogSerializer can
+  // resume appending after a crash. Only the last intact block is validated
+  // record by record; see find_log_tail(). Returns the number of valid
+  // records.
+  inline uint64_t recover_log(
+    DestructorExceptions &exceptions,
+    char const *filename,
+    uint64_t page_size = 1024 * 1024)
+  {
+    LogTail tail;
+    uint64_t file_size;
+    {
+      Deserializer deserializer(exceptions, filename, page_size);
+      deserializer.set_access_pattern(AccessPattern::sequential);
+      tail = find_log_tail(deserializer);
+      file_size = deserializer.get_file_size();
+    }
+    if (tail.valid_end != file_size) {
+      std::error_code error;
+      std::filesystem::resize_file(filename, tail.valid_end, error);
+      if (error) {
+        throw WriteException(filename, "failed to truncate: " + error.message());
+      }
+    }
+    return tail.record_count;
+  }
+
+#if defined(PICKAXE_POSIX)
+  // A writer shared by many threads. Each thread claims a range of the file
+  // with reserve(), a single atomic fetch-add, and fills it with
+  // write_at(), which is a pwrite() and takes no lock, so producers never
+  // wait on each other for I/O. Only recording a finished write takes a
+  // short lock.
+  class ConcurrentSerializer {
+    int _fd;
+    std::atomic<uint64_t> _reserved_offset;
+    DestructorExceptions *_exceptions;
+    std::string _filename;
+    std::mutex _mutex;
+    std::condition_variable _written;
+    // Every byte before _written_end has been written. Written ranges past
+    // it, keyed by begin with their end as value, are merged into it as the
+    // gaps before them are filled.
+    uint64_t _written_end;
+    std::map<uint64_t, uint64_t> _written_ranges;
+    bool _failed;
+
+  public:
+    ~ConcurrentSerializer() noexcept
+    {
+      try {
+        _close();
+      }
+      catch (CloseException const &e) {
+        _exceptions->close.push_back(e);
+      }
+    }
+
+    ConcurrentSerializer(
+      DestructorExceptions &exceptions,
+      char const *filename)
+      : _fd(::open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666))
+      , _reserved_offset(0)
+      , _exceptions(&exceptions)
+      , _filename(filename)
+      , _written_end(0)
+      , _failed(false)
+    {
+      if (_fd < 0) {
+        throw WriteException(_filename, "failed to open");
+      }
+    }
+
+    ConcurrentSerializer(ConcurrentSerializer const &) = delete;
+    ConcurrentSerializer &operator=(ConcurrentSerializer const &) = delete;
+
+    [[nodiscard]] std::string const &get_filename() const
+    {
+      return _filename;
+    }
+
+    // End of the last reserved range.
+    [[nodiscard]] uint64_t get_offset() const
+    {
+      return _reserved_offset.load(std::memory_order_relaxed);
+    }
+
+    // Claims the next size bytes of the file and returns their offset. The
+    // caller must write exactly those bytes with write_at().
+    uint64_t reserve(
+      uint64_t size)
+    {
+      return _reserved_offset.fetch_add(size, std::memory_order_relaxed);
+    }
+
+    // Writes into a reserved range. A range may be filled by several calls.
+    // A failed write makes every later flush() throw, since its range will
+    // never be complete.
+    void write_at(
+      uint64_t offset,
+      void const *data,
+      uint64_t size)
+    {
+      auto const *bytes = static_cast<std::byte const *>(data);
+      auto begin = offset;
+      uint64_t remaining = size;
+      while (remaining != 0) {
+        auto n = ::pwrite(_fd, bytes, remaining, static_cast<off_t>(offset));
+        if (n < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+          {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _failed = true;
+          }
+          _written.notify_all();
+          throw WriteException(_filename);
+        }
+        bytes += n;
+        offset += n;
+        remaining -= n;
+      }
+      _mark_written(begin, begin + size);
+    }
+
+    // Reserves and writes in one step; returns the offset written to.
+    uint64_t write(
+      void const *data,
+      uint64_t size)
+    {
+      auto offset = reserve(size);
+      write_at(offset, data, size);
+      return offset;
+    }
+
+    // Waits until every range reserved before the call has been written.
+    // Ranges reserved afterwards are not waited for. Throws if a write has
+    // failed.
+    void flush()
+    {
+      auto target = _reserved_offset.load(std::memory_order_acquire);
+      std::unique_lock<std::mutex> lock(_mutex);
+      _written.wait(lock, [&] { return _failed || _written_end >= target; });
+      if (_failed) {
+        throw WriteException(_filename, "an earlier write failed");
+      }
+    }
+
+  private:
+    void _mark_written(
+      uint64_t begin,
+      uint64_t end)
+    {
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        begin = std::max(begin, _written_end);
+        if (begin >= end) {
+          return;
+        }
+        // Merge with every written range that overlaps or touches
+        // [begin, end).
+        auto it = _written_ranges.upper_bound(begin);
+        if (it != _written_ranges.begin() && std::prev(it)->second >= begin) {
+          --it;
+          begin = it->first;
+        }
+        while (it != _written_ranges.end() && it->first <= end) {
+          end = std::max(end, it->second);
+          it = _written_ranges.erase(it);
+        }
+        if (begin > _written_end) {
+          _written_ranges.emplace(begin, end);
+          return;
+        }
+        _written_end = end;
+      }
+      _written.notify_all();
+    }
+
+    void _close()
+    {
+      if (_fd >= 0) {
+        // A reserved range at the end that was never written still counts
+        // towards the file size.
+        auto resized = ::ftruncate(_fd, static_cast<off_t>(_reserved_offset.load())) == 0;
+        auto ret = ::close(_fd);
+        _fd = -1;
+        if (ret != 0 || !resized) {
+          throw CloseException(_filename);
+        }
+      }
+    }
+  };
+#endif
+
+  // A Serializer front-end that never blocks producers on I/O. Producers
+  // copy byte slices into a bounded lock-free multi-producer queue (Dmitry
+  // Vyukov's design: a ring of slots, each with a sequence number that
+  // tells producers and the consumer whose turn it is), and a dedicated
+  // writer thread drains the queue into large batched writes.
+  //
+  // Slices are written in the order they were enqueued; each slice is
+  // written contiguously.
+  class AsyncSerializer {
+    static constexpr uint64_t _batch_size = 1024 * 1024;
+
+    struct alignas(64) _Slot {
+      std::atomic<uint64_t> sequence;
+      uint64_t size;
+    };
+
+    Serializer _serializer;
+    uint64_t _slot_mask;
+    uint64_t _slot_size;
+    std::vector<_Slot> _slots;
+    std::vector<std::byte> _payloads;
+    alignas(64) std::atomic<uint64_t> _enqueue_position;
+    alignas(64) std::atomic<uint64_t> _completed_position;
+    std::atomic<bool> _stopping;
+    std::atomic<bool> _failed;
+    std::exception_ptr _error;
+    uint64_t _dequeue_position;
+    std::vector<std::byte> _batch;
+    std::thread _writer;
+
+  public:
+    // slot_count must be a power of two; slot_size is the largest slice
+    // that can be pushed.
+    AsyncSerializer(
+      DestructorExceptions &exceptions,
+      char const *filename,
+      uint64_t slot_count = 4096,
+      uint64_t slot_size = 256)
+      : _serializer(exceptions, filename)
+      , _slot_mask(slot_count - 1)
+      , _slot_size(slot_size)
+      , _slots(slot_count)
+      , _payloads(slot_count * slot_size)
+      , _enqueue_position(0)
+      , _completed_position(0)
+      , _stopping(false)
+      , _failed(false)
+      , _dequeue_position(0)
+    {
+      if (slot_count == 0 || (slot_count & _slot_mask) != 0) {
+        throw WriteException(_serializer.get_filename(), "slot count must be a power of two");
+      }
+      for (uint64_t i = 0; i < slot_count; ++i) {
+        _slots[i].sequence.store(i, std::memory_order_relaxed);
+      }
+      _batch.reserve(_batch_size + slot_size);
+      _writer = std::thread([this] { _run(); });
+    }
+
+    // Writes whatever is still queued. A write error that was not already
+    // reported by flush() is lost, so call flush() first to observe it.
+    ~AsyncSerializer() noexcept
+    {
+      _stopping.store(true, std::memory_order_release);
+      _writer.join();
+    }
+
+    AsyncSerializer(AsyncSerializer const &) = delete;
+    AsyncSerializer &operator=(AsyncSerializer const &) = delete;
+
+    // Enqueues a copy of the slice without blocking. Returns false if the
+    // queue is full. Rethrows the writer thread's error once it has failed,
+    // since the queue will never drain again.
+    [[nodiscard]] bool try_push(
+      void const *data,
+      uint64_t size)
+    {
+      if (_failed.load(std::memory_order_acquire)) {
+        std::rethrow_exception(_error);
+      }
+      if (size > _slot_size) {
+        throw WriteException(_serializer.get_filename(), "slice larger than slot size");
+      }
+      auto position = _enqueue_position.load(std::memory_order_relaxed);
+      _Slot *slot;
+      while (true) {
+        slot = &_slots[position & _slot_mask];
+        auto sequence = slot->sequence.load(std::memory_order_acquire);
+        auto difference = static_cast<int64_t>(sequence - position);
+        if (difference == 0) {
+          if (_enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+            break;
+          }
+        }
+        else if (difference < 0) {
+          return false;
+        }
+        else {
+          position = _enqueue_position.load(std::memory_order_relaxed);
+        }
+      }
+      if (size != 0) {
+        std::memcpy(_payloads.data() + (position & _slot_mask) * _slot_size, data, size);
+      }
+      slot->size = size;
+      slot->sequence.store(position + 1, std::memory_order_release);
+      return true;
+    }
+
+    // Enqueues a copy of the slice, spinning while the queue is full.
+    void push(
+      void const *data,
+      uint64_t size)
+    {
+      while (!try_push(data, size)) {
+        std::this_thread::yield();
+      }
+    }
+
+    template <typename T>
+    void push(
+      T const &data)
+    {
+      static_assert(std::is_pod_v<T>);
+      push(&data, sizeof(T));
+    }
+
+    // Waits until every slice enqueued so far has been handed to the
+    // operating system, and rethrows any error of the writer thread.
+    void flush()
+    {
+      auto target = _enqueue_position.load(std::memory_order_acquire);
+      while (true) {
+        auto completed = _completed_position.load(std::memory_order_acquire);
+        if (completed >= target) {
+          break;
+        }
+        _completed_position.wait(completed, std::memory_order_acquire);
+      }
+      if (_failed.load(std::memory_order_acquire)) {
+        std::rethrow_exception(_error);
+      }
+    }
+
+  private:
+    void _run()
+    {
+      try {
+        uint64_t idle = 0;
+        while (true) {
+          if (_drain() != 0) {
+            idle = 0;
+            if (_batch.size() >= _batch_size) {
+              _write_batch();
+            }
+            continue;
+          }
+          if (!_batch.empty()) {
+            _write_batch();
+            continue;
+          }
+          if (_stopping.load(std::memory_order_acquire)) {
+            if (_drain() == 0) {
+              break;
+            }
+            continue;
+          }
+          if (++idle < 64) {
+            std::this_thread::yield();
+          }
+          else {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+          }
+        }
+      }
+      catch (...) {
+        _error = std::current_exception();
+        _failed.store(true, std::memory_order_release);
+        _completed_position.store(UINT64_MAX, std::memory_order_release);
+        _completed_position.notify_all();
+      }
+    }
+
+    // Moves every published slice into the batch, up to the batch size, and
+    // returns how many were moved.
+    uint64_t _drain()
+    {
+      uint64_t count = 0;
+      while (_batch.size() < _batch_size) {
+        auto &slot = _slots[_dequeue_position & _slot_mask];
+        if (slot.sequence.load(std::memory_order_acquire) != _dequeue_position + 1) {
+          break;
+        }
+        auto const *payload = _payloads.data() + (_dequeue_position & _slot_mask) * _slot_size;
+        _batch.insert(_batch.end(), payload, payload + slot.size);
+        slot.sequence.store(_dequeue_position + _slot_mask + 1, std::memory_order_release);
+        ++_dequeue_position;
+        ++count;
+      }
+      return count;
+    }
+
+    // Writes the batch and publishes every slice in it as completed, so
+    // that flush() keeps making progress under sustained load.
+    void _write_batch()
+    {
+      _serializer.write(_batch.data(), _batch.size());
+      _batch.clear();
+      _serializer.flush();
+      _completed_position.store(_dequeue_position, std::memory_order_release);
+      _completed_position.notify_all();
+    }
+  };
+
+  // Serializes section_count independent sections in parallel, calling
+  // serialize(index, section) with a fresh MemorySerializer for each on up
+  // to thread_count threads, then splices them into serializer in index
+  // order. Returns the offset each section was spliced at. The first
+  // exception thrown by serialize() stops the remaining sections and is
+  // rethrown.
+  template <typename Serialize>
+  std::vector<uint64_t> serialize_sections(
+    Serializer &serializer,
+    uint64_t section_count,
+    Serialize &&serialize,
+    uint64_t thread_count = std::thread::hardware_concurrency())
+  {
+    std::vector<MemorySerializer> sections(section_count);
+    std::atomic<uint64_t> next_section{0};
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto work = [&] {
+      while (true) {
+        auto index = next_section.fetch_add(1, std::memory_order_relaxed);
+        if (index >= section_count) {
+          return;
+        }
+        try {
+          serialize(index, sections[index]);
+        }
+        catch (...) {
+          std::lock_guard<std::mutex> lock(error_mutex);
+          if (error == nullptr) {
+            error = std::current_exception();
+          }
+          next_section.store(section_count, std::memory_order_relaxed);
+          return;
+        }
+      }
+    };
+    std::vector<std::thread> threads;
+    for (uint64_t i = 1; i < std::min(thread_count, section_count); ++i) {
+      threads.emplace_back(work);
+    }
+    work();
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    if (error != nullptr) {
+      std::rethrow_exception(error);
+    }
+    std::vector<uint64_t> offsets;
+    offsets.reserve(section_count);
+    for (auto &section : sections) {
+      offsets.push_back(serializer.splice(section));
+      section = MemorySerializer();
+    }
+    return offsets;
+  }
+
+  // Calls decode(index, deserializer) for every section of a file, on up to
+  // thread_count threads. Each thread reads through its own Deserializer,
+  // which is positioned at the start of the section before the call, so
+  // per-section decoding code is the same as for a single reader.
+  //
+  // Every thread starts with a contiguous share of the sections and takes
+  // them from the front; a thread that runs out steals the back half of
+  // another thread's remaining share, so sections of very uneven sizes
+  // still keep every thread busy. The first exception thrown stops the
+  // remaining sections and is rethrown.
+  template <typename Decode>
+  void parallel_for_each_section(
+    DestructorExceptions &exceptions,
+    char const *filename,
+    uint64_t page_size,
+    std::span<FileSection const> sections,
+    Decode &&decode,
+    uint64_t thread_count = std::thread::hardware_concurrency())
+  {
+    struct alignas(64) Share {
+      std::mutex mutex;
+      uint64_t begin;
+      uint64_t end;
+    };
+
+    thread_count = std::max<uint64_t>(1, std::min<uint64_t>(thread_count, sections.size()));
+    std::vector<Share> shares(thread_count);
+    for (uint64_t i = 0; i < thread_count; ++i) {
+      shares[i].begin = sections.size() * i / thread_count;
+      shares[i].end = sections.size() * (i + 1) / thread_count;
+    }
+    std::atomic<bool> stopping{false};
+    std::exception_ptr error;
+    std::mutex mutex;
+
+    auto take = [&](uint64_t worker, uint64_t &index) {
+      {
+        std::lock_guard<std::mutex> lock(shares[worker].mutex);
+        if (shares[worker].begin < shares[worker].end) {
+          index = shares[worker].begin++;
+          return true;
+        }
+      }
+      for (uint64_t i = 1; i < thread_count; ++i) {
+        auto &victim = shares[(worker + i) % thread_count];
+        uint64_t begin;
+        uint64_t end;
+        {
+          std::lock_guard<std::mutex> lock(victim.mutex);
+          if (victim.begin >= victim.end) {
+            continue;
+          }
+          end = victim.end;
+          begin = victim.end - (victim.end - victim.begin + 1) / 2;
+          victim.end = begin;
+        }
+        std::lock_guard<std::mutex> lock(shares[worker].mutex);
+        shares[worker].begin = begin + 1;
+        shares[worker].end = end;
+        index = begin;
+        return true;
+      }
+      return false;
+    };
+
+    auto work = [&](uint64_t worker) {
+      DestructorExceptions worker_exceptions;
+      try {
+        Deserializer deserializer(worker_exceptions, filename, page_size);
+        uint64_t index;
+        while (!stopping.load(std::memory_order_relaxed) && take(worker, index)) {
+          deserializer.set_offset(sections[index].offset);
+          decode(index, deserializer);
+        }
+      }
+      catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (error == nullptr) {
+          error = std::current_exception();
+        }
+        stopping.store(true, std::memory_order_relaxed);
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      exceptions.close.insert(exceptions.close.end(), worker_exceptions.close.begin(), worker_exceptions.close.end());
+    };
+
+    std::vector<std::thread> threads;
+    for (uint64_t i = 1; i < thread_count; ++i) {
+      threads.emplace_back(work, i);
+    }
+    work(0);
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    if (error != nullptr) {
+      std::rethrow_exception(error);
+    }
+  }
+
+#if defined(PICKAXE_POSIX)
+  class EventLoop;
+
+  // The coroutine type run by an EventLoop. A task is started with
+  // EventLoop::spawn() and awaits AsyncReader::read_async() and
+  // AsyncWriter::write_async() directly in its body.
+  class AsyncTask {
+  public:
+    struct promise_type {
+      std::exception_ptr error;
+      uint64_t index = 0;
+
+      AsyncTask get_return_object()
+      {
+        return AsyncTask(std::coroutine_handle<promise_type>::from_promise(*this));
+      }
+
+      std::suspend_always initial_suspend() noexcept
+      {
+        return {};
+      }
+
+      std::suspend_always final_suspend() noexcept
+      {
+        return {};
+      }
+
+      void return_void()
+      {}
+
+      void unhandled_exception()
+      {
+        error = std::current_exception();
+      }
+    };
+
+  private:
+    friend class EventLoop;
+
+    std::coroutine_handle<promise_type> _handle;
+
+    explicit AsyncTask(
+      std::coroutine_handle<promise_type> handle)
+      : _handle(handle)
+    {}
+
+  public:
+    ~AsyncTask() noexcept
+    {
+      if (_handle) {
+        _handle.destroy();
+      }
+    }
+
+    AsyncTask(
+      AsyncTask &&other) noexcept
+      : _handle(std::exchange(other._handle, {}))
+    {}
+
+    AsyncTask(AsyncTask const &) = delete;
+    AsyncTask &operator=(AsyncTask const &) = delete;
+  };
+
+  // Drives many AsyncTasks on one thread. Reads and writes are submitted to
+  // an io_uring, and each task is resumed when its transfer completes. When
+  // io_uring is unavailable (older kernels, seccomp sandboxes, non-Linux
+  // systems) transfers are completed synchronously with pread/pwrite, so
+  // tasks behave the same, only without the overlap.
+  class EventLoop {
+  public:
+    // One transfer awaited by a task. Short transfers are resubmitted for
+    // the remainder until the whole range is done, an error occurs, or the
+    // end of the file is reached.
+    struct Operation {
+      std::coroutine_handle<AsyncTask::promise_type> handle;
+      int fd;
+      bool is_write;
+      std::byte *data;
+      uint64_t size;
+      uint64_t offset;
+      uint64_t transferred;
+      int error;
+      iovec vector;
+    };
+
+  private:
+    std::vector<std::coroutine_handle<AsyncTask::promise_type>> _tasks;
+    std::deque<std::coroutine_handle<AsyncTask::promise_type>> _ready;
+    std::exception_ptr _error;
+#if defined(PICKAXE_IO_URING)
+    int _ring_fd;
+    uint32_t _capacity;
+    uint64_t _in_flight;
+    uint32_t _to_submit;
+    std::deque<Operation *> _waiting;
+    void *_sq_ring;
+    size_t _sq_ring_size;
+    void *_cq_ring;
+    size_t _cq_ring_size;
+    io_uring_sqe *_sqes;
+    size_t _sqes_size;
+    unsigned *_sq_tail;
+    unsigned *_sq_mask;
+    unsigned *_sq_array;
+    unsigned *_cq_head;
+    unsigned *_cq_tail;
+    unsigned *_cq_mask;
+    io_uring_cqe *_cqes;
+#endif
+
+  public:
+    // At most entries transfers are in flight at once; further transfers
+    // wait in a queue until earlier ones complete.
+    explicit EventLoop(
+      uint32_t entries = 256)
+#if defined(PICKAXE_IO_URING)
+      : _ring_fd(-1)
+      , _capacity(0)
+      , _in_flight(0)
+      , _to_submit(0)
+      , _sq_ring(MAP_FAILED)
+      , _sq_ring_size(0)
+      , _cq_ring(MAP_FAILED)
+      , _cq_ring_size(0)
+      , _sqes(static_cast<io_uring_sqe *>(MAP_FAILED))
+      , _sqes_size(0)
+#endif
+    {
+#if defined(PICKAXE_IO_URING)
+      _setup(entries);
+#else
+      (void)entries;
+#endif
+    }
+
+    ~EventLoop() noexcept
+    {
+#if defined(PICKAXE_IO_URING)
+      // The kernel may still write into buffers of suspended tasks until
+      // their transfers complete.
+      _waiting.clear();
+      while (_ring_fd >= 0 && _in_flight != 0) {
+        try {
+          _enter(1);
+          _reap();
+        }
+        catch (Exception const &) {
+          break;
+        }
+      }
+      _teardown();
+#endif
+      for (auto task : _tasks) {
+        task.destroy();
+      }
+    }
+
+    EventLoop(EventLoop const &) = delete;
+    EventLoop &operator=(EventLoop const &) = delete;
+
+    [[nodiscard]] bool is_io_uring() const
+    {
+#if defined(PICKAXE_IO_URING)
+      return _ring_fd >= 0;
+#else
+      return false;
+#endif
+    }
+
+    // Schedules a task; it starts running in the next call to run().
+    void spawn(
+      AsyncTask task)
+    {
+      auto handle = std::exchange(task._handle, {});
+      handle.promise().index = _tasks.size();
+      _tasks.push_back(handle);
+      _ready.push_back(handle);
+    }
+
+    // Runs until every spawned task has finished. The first exception that
+    // escaped a task is rethrown once the others are done.
+    void run()
+    {
+      while (!_tasks.empty()) {
+        while (!_ready.empty()) {
+          auto handle = _ready.front();
+          _ready.pop_front();
+          _resume(handle);
+        }
+        if (_tasks.empty()) {
+          break;
+        }
+#if defined(PICKAXE_IO_URING)
+        if (_ring_fd >= 0 && _in_flight != 0) {
+          _enter(1);
+          _reap();
+          continue;
+        }
+#endif
+        throw Exception("event loop tasks are waiting on something other than the loop");
+      }
+      if (_error != nullptr) {
+        std::rethrow_exception(std::exchange(_error, nullptr));
+      }
+    }
+
+    // Starts a transfer; the task of operation.handle is resumed when it
+    // completes.
+    void submit(
+      Operation &operation)
+    {
+#if defined(PICKAXE_IO_URING)
+      if (_ring_fd >= 0) {
+        if (_in_flight == _capacity) {
+          _waiting.push_back(&operation);
+        }
+        else {
+          _push(operation);
+        }
+        return;
+      }
+#endif
+      _transfer(operation);
+      _ready.push_back(operation.handle);
+    }
+
+  private:
+    void _resume(
+      std::coroutine_handle<AsyncTask::promise_type> handle)
+    {
+      handle.resume();
+      if (!handle.done()) {
+        return;
+      }
+      auto &promise = handle.promise();
+      if (promise.error != nullptr && _error == nullptr) {
+        _error = promise.error;
+      }
+      auto index = promise.index;
+      _tasks[index] = _tasks.back();
+      _tasks[index].promise().index = index;
+      _tasks.pop_back();
+      handle.destroy();
+    }
+
+    static void _transfer(
+      Operation &operation)
+    {
+      while (operation.transferred < operation.size) {
+        auto *data = operation.data + operation.transferred;
+        auto size = operation.size - operation.transferred;
+        auto offset = static_cast<off_t>(operation.offset + operation.transferred);
+        auto ret = operation.is_write
+          ? ::pwrite(operation.fd, data, size, offset)
+          : ::pread(operation.fd, data, size, offset);
+        if (ret < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+          operation.error = errno;
+          return;
+        }
+        if (ret == 0) {
+          return;
+        }
+        operation.transferred += static_cast<uint64_t>(ret);
+      }
+    }
+
+#if defined(PICKAXE_IO_URING)
+    void _setup(
+      uint32_t entries)
+    {
+      io_uring_params params;
+      std::memset(&params, 0, sizeof(params));
+      auto fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+      if (fd < 0) {
+        return;
+      }
+      _ring_fd = fd;
+      _capacity = params.sq_entries;
+      _sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+      _cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+      if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+        _sq_ring_size = std::max(_sq_ring_size, _cq_ring_size);
+      }
+      _sq_ring = ::mmap(nullptr, _sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+      if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+        _cq_ring = _sq_ring;
+      }
+      else if (_sq_ring != MAP_FAILED) {
+        _cq_ring = ::mmap(nullptr, _cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+      }
+      _sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+      if (_cq_ring != MAP_FAILED) {
+        _sqes = static_cast<io_uring_sqe *>(::mmap(nullptr, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+      }
+      if (_sqes == MAP_FAILED) {
+        _teardown();
+        return;
+      }
+      auto *sq = static_cast<std::byte *>(_sq_ring);
+      auto *cq = static_cast<std::byte *>(_cq_ring);
+      _sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+      _sq_mask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+      _sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+      _cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+      _cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+      _cq_mask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+      _cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+    }
+
+    void _teardown()
+    {
+      if (_sqes != MAP_FAILED) {
+        ::munmap(_sqes, _sqes_size);
+        _sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+      }
+      if (_cq_ring != MAP_FAILED && _cq_ring != _sq_ring) {
+        ::munmap(_cq_ring, _cq_ring_size);
+      }
+      _cq_ring = MAP_FAILED;
+      if (_sq_ring != MAP_FAILED) {
+        ::munmap(_sq_ring, _sq_ring_size);
+        _sq_ring = MAP_FAILED;
+      }
+      if (_ring_fd >= 0) {
+        ::close(_ring_fd);
+        _ring_fd = -1;
+      }
+    }
+
+    // Queues a submission for the rest of the operation's range. The
+    // in-flight limit equals the submission queue size and is at most half
+    // the completion queue size, so neither queue can overflow.
+    void _push(
+      Operation &operation)
+    {
+      operation.vector.iov_base = operation.data + operation.transferred;
+      operation.vector.iov_len = operation.size - operation.transferred;
+      auto tail = *_sq_tail;
+      auto index = tail & *_sq_mask;
+      auto &sqe = _sqes[index];
+      std::memset(&sqe, 0, sizeof(sqe));
+      sqe.opcode = operation.is_write ? IORING_OP_WRITEV : IORING_OP_READV;
+      sqe.fd = operation.fd;
+      sqe.off = operation.offset + operation.transferred;
+      sqe.addr = reinterpret_cast<uintptr_t>(&operation.vector);
+      sqe.len = 1;
+      sqe.user_data = reinterpret_cast<uintptr_t>(&operation);
+      _sq_array[index] = index;
+      std::atomic_ref<unsigned>(*_sq_tail).store(tail + 1, std::memory_order_release);
+      ++_in_flight;
+      ++_to_submit;
+    }
+
+    // Submits queued entries and waits for at least min_complete
+    // completions.
+    void _enter(
+      unsigned min_complete)
+    {
+      while (true) {
+        auto ret = ::syscall(__NR_io_uring_enter, _ring_fd, _to_submit, min_complete, IORING_ENTER_GETEVENTS, nullptr, 0);
+        if (ret >= 0) {
+          _to_submit -= static_cast<uint32_t>(ret);
+          return;
+        }
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+          throw Exception(std::string("io_uring_enter failed: ") + std::strerror(errno));
+        }
+        if (errno == EINTR) {
+          continue;
+        }
+        // Out of kernel resources; wait for completions without submitting.
+        if (::syscall(__NR_io_uring_enter, _ring_fd, 0, min_complete, IORING_ENTER_GETEVENTS, nullptr, 0) >= 0) {
+          return;
+        }
+        if (errno != EINTR) {
+          throw Exception(std::string("io_uring_enter failed: ") + std::strerror(errno));
+        }
+      }
+    }
+
+    // Consumes every available completion, resubmitting short transfers and
+    // marking finished tasks ready, then fills freed slots from the waiting
+    // queue.
+    void _reap()
+    {
+      auto head = *_cq_head;
+      auto tail = std::atomic_ref<unsigned>(*_cq_tail).load(std::memory_order_acquire);
+      while (head != tail) {
+        auto const &cqe = _cqes[head & *_cq_mask];
+        auto *operation = reinterpret_cast<Operation *>(static_cast<uintptr_t>(cqe.user_data));
+        auto result = cqe.res;
+        ++head;
+        std::atomic_ref<unsigned>(*_cq_head).store(head, std::memory_order_release);
+        --_in_flight;
+        if (result < 0) {
+          operation->error = -result;
+        }
+        else if (result > 0) {
+          operation->transferred += static_cast<uint64_t>(result);
+          if (operation->transferred < operation->size) {
+            _push(*operation);
+            continue;
+          }
+        }
+        _ready.push_back(operation->handle);
+      }
+      while (!_waiting.empty() && _in_flight < _capacity) {
+        _push(*_waiting.front());
+        _waiting.pop_front();
+      }
+    }
+#endif
+  };
+
+  // Reads a file from tasks on an EventLoop. Unlike Deserializer it has no
+  // page buffer, so a single thread can keep hundreds of files open and
+  // reading at little cost per file.
+  class AsyncReader {
+    EventLoop *_loop;
+    int _fd;
+    uint64_t _offset;
+    DestructorExceptions *_exceptions;
+    std::string _filename;
+
+  public:
+    class Awaitable {
+      friend class AsyncReader;
+
+      AsyncReader *_reader;
+      EventLoop::Operation _operation;
+
+      Awaitable(
+        AsyncReader *reader,
+        void *data,
+        uint64_t size,
+        uint64_t offset)
+        : _reader(reader)
+        , _operation{{}, reader->_fd, false, static_cast<std::byte *>(data), size, offset, 0, 0, {}}
+      {}
+
+    public:
+      [[nodiscard]] bool await_ready() const noexcept
+      {
+        return _operation.size == 0;
+      }
+
+      void await_suspend(
+        std::coroutine_handle<AsyncTask::promise_type> handle)
+      {
+        _operation.handle = handle;
+        _reader->_loop->submit(_operation);
+      }
+
+      void await_resume() const
+      {
+        if (_operation.error != 0) {
+          throw ReadException(_reader->_filename, std::strerror(_operation.error));
+        }
+        if (_operation.transferred < _operation.size) {
+          throw ReadException(_reader->_filename, "not enough remaining bytes at current offset");
+        }
+      }
+    };
+
+    ~AsyncReader() noexcept
+    {
+      try {
+        _close();
+      }
+      catch (CloseException const &e) {
+        _exceptions->close.push_back(e);
+      }
+    }
+
+    AsyncReader(
+      EventLoop &loop,
+      DestructorExceptions &exceptions,
+      char const *filename)
+      : _loop(&loop)
+      , _fd(::open(filename, O_RDONLY | O_CLOEXEC))
+      , _offset(0)
+      , _exceptions(&exceptions)
+      , _filename(filename)
+    {
+      if (_fd < 0) {
+        throw ReadException(_filename, "failed to open");
+      }
+    }
+
+    AsyncReader(AsyncReader const &) = delete;
+    AsyncReader &operator=(AsyncReader const &) = delete;
+
+    [[nodiscard]] std::string const &get_filename() const
+    {
+      return _filename;
+    }
+
+    [[nodiscard]] uint64_t get_offset() const
+    {
+      return _offset;
+    }
+
+    void set_offset(
+      uint64_t offset)
+    {
+      _offset = offset;
+    }
+
+    // Reads exactly size bytes at the current offset, which advances
+    // immediately, so several reads of one file can be in flight at once.
+    [[nodiscard]] Awaitable read_async(
+      void *data,
+      uint64_t size)
+    {
+      auto offset = _offset;
+      _offset += size;
+      return Awaitable(this, data, size, offset);
+    }
+
+    template <typename T>
+    [[nodiscard]] Awaitable read_async(
+      T &data)
+    {
+      static_assert(std::is_pod_v<T>);
+      return read_async(&data, sizeof(T));
+    }
+
+  private:
+    void _close()
+    {
+      if (_fd >= 0) {
+        auto ret = ::close(_fd);
+        _fd = -1;
+        if (ret != 0) {
+          throw CloseException(_filename);
+        }
+      }
+    }
+  };
+
+  // Writes a file from tasks on an EventLoop. The source of a write must
+  // stay valid until the write has been awaited.
+  class AsyncWriter {
+    EventLoop *_loop;
+    int _fd;
+    uint64_t _offset;
+    DestructorExceptions *_exceptions;
+    std::string _filename;
+
+  public:
+    class Awaitable {
+      friend class AsyncWriter;
+
+      AsyncWriter *_writer;
+      EventLoop::Operation _operation;
+
+      Awaitable(
+        AsyncWriter *writer,
+        void const *data,
+        uint64_t size,
+        uint64_t offset)
+        : _writer(writer)
+        , _operation{{}, writer->_fd, true, static_cast<std::byte *>(const_cast<void *>(data)), size, offset, 0, 0, {}}
+      {}
+
+    public:
+      [[nodiscard]] bool await_ready() const noexcept
+      {
+        return _operation.size == 0;
+      }
+
+      void await_suspend(
+        std::coroutine_handle<AsyncTask::promise_type> handle)
+      {
+        _operation.handle = handle;
+        _writer->_loop->submit(_operation);
+      }
+
+      void await_resume() const
+      {
+        if (_operation.error != 0) {
+          throw WriteException(_writer->_filename, std::strerror(_operation.error));
+        }
+        if (_operation.transferred < _operation.size) {
+          throw WriteException(_writer->_filename);
+        }
+      }
+    };
+
+    ~AsyncWriter() noexcept
+    {
+      try {
+        _close();
+      }
+      catch (CloseException const &e) {
+        _exceptions->close.push_back(e);
+      }
+    }
+
+    AsyncWriter(
+      EventLoop &loop,
+      DestructorExceptions &exceptions,
+      char const *filename)
+      : _loop(&loop)
+      , _fd(::open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666))
+      , _offset(0)
+      , _exceptions(&exceptions)
+      , _filename(filename)
+    {
+      if (_fd < 0) {
+        throw WriteException(_filename, "failed to open");
+      }
+    }
+
+    AsyncWriter(AsyncWriter const &) = delete;
+    AsyncWriter &operator=(AsyncWriter const &) = delete;
+
+    [[nodiscard]] std::string const &get_filename() const
+    {
+      return _filename;
+    }
+
+    [[nodiscard]] uint64_t get_offset() const
+    {
+      return _offset;
+    }
+
+    void set_offset(
+      uint64_t offset)
+    {
+      _offset = offset;
+    }
+
+    // Writes size bytes at the current offset, which advances immediately,
+    // so several writes of one file can be in flight at once.
+    [[nodiscard]] Awaitable write_async(
+      void const *data,
+      uint64_t size)
+    {
+      auto offset = _offset;
+      _offset += size;
+      return Awaitable(this, data, size, offset);
+    }
+
+    template <typename T>
+    [[nodiscard]] Awaitable write_async(
+      T const &data)
+    {
+      static_assert(std::is_pod_v<T>);
+      return write_async(&data, sizeof(T));
+    }
+
+  private:
+    void _close()
+    {
+      if (_fd >= 0) {
+        auto ret = ::close(_fd);
+        _fd = -1;
+        if (ret != 0) {
+          throw CloseException(_filename);
+        }
+      }
+    }
+  };
+#endif
+
+#if defined(PICKAXE_POSIX)
+  // Reads many small ranges from many files without a Deserializer per
+  // file. Requests are grouped by file, so each file is opened once, and
+  // ranges that are adjacent, or separated by at most max_gap bytes, are
+  // read together with a single preadv. Files are spread over up to
+  // thread_count threads, since opening files dominates for small reads.
+  class BatchReader {
+    struct _Request {
+      std::string filename;
+      uint64_t offset;
+      uint64_t size;
+      std::byte *data;
+    };
+
+    std::vector<_Request> _requests;
+    uint64_t _max_gap;
+
+  public:
+    explicit BatchReader(
+      uint64_t max_gap = 4096)
+      : _max_gap(max_gap)
+    {}
+
+    [[nodiscard]] uint64_t get_request_count() const
+    {
+      return _requests.size();
+    }
+
+    // Requests size bytes at offset of filename, to be stored in data when
+    // read() is called. Ranges of one file may overlap.
+    void add(
+      char const *filename,
+      uint64_t offset,
+      uint64_t size,
+      void *data)
+    {
+      _requests.push_back({filename, offset, size, static_cast<std::byte *>(data)});
+    }
+
+    // Reads every request and then clears them. The first exception thrown
+    // stops the remaining files and is rethrown.
+    void read(
+      uint64_t thread_count = 1)
+    {
+      std::vector<uint64_t> order(_requests.size());
+      for (uint64_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+      }
+      std::sort(order.begin(), order.end(), [this](uint64_t a, uint64_t b) {
+        auto compare = _requests[a].filename.compare(_requests[b].filename);
+        return compare != 0 ? compare < 0 : _requests[a].offset < _requests[b].offset;
+      });
+      // Start of each file's requests in order, plus the end.
+      std::vector<uint64_t> files;
+      for (uint64_t i = 0; i < order.size(); ++i) {
+        if (i == 0 || _requests[order[i]].filename != _requests[order[i - 1]].filename) {
+          files.push_back(i);
+        }
+      }
+      files.push_back(order.size());
+
+      auto file_count = files.size() - 1;
+      std::atomic<uint64_t> next_file{0};
+      std::exception_ptr error;
+      std::mutex error_mutex;
+      auto work = [&] {
+        std::vector<std::byte> gap(_max_gap);
+        std::vector<iovec> vectors;
+        while (true) {
+          auto file = next_file.fetch_add(1, std::memory_order_relaxed);
+          if (file >= file_count) {
+            return;
+          }
+          try {
+            _read_file(std::span<uint64_t const>(order.data() + files[file], order.data() + files[file + 1]), gap, vectors);
+          }
+          catch (...) {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (error == nullptr) {
+              error = std::current_exception();
+            }
+            next_file.store(file_count, std::memory_order_relaxed);
+            return;
+          }
+        }
+      };
+      std::vector<std::thread> threads;
+      for (uint64_t i = 1; i < std::min<uint64_t>(thread_count, file_count); ++i) {
+        threads.emplace_back(work);
+      }
+      work();
+      for (auto &thread : threads) {
+        thread.join();
+      }
+      _requests.clear();
+      if (error != nullptr) {
+        std::rethrow_exception(error);
+      }
+    }
+
+  private:
+    void _read_file(
+      std::span<uint64_t const> order,
+      std::vector<std::byte> &gap,
+      std::vector<iovec> &vectors)
+    {
+      auto const &filename = _requests[order.front()].filename;
+      auto fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd < 0) {
+        throw ReadException(filename, "failed to open");
+      }
+      try {
+        uint64_t i = 0;
+        while (i < order.size()) {
+          // Extend the run while the next range starts at, or at most
+          // max_gap bytes after, the end of the previous one. Gaps are read
+          // into a scratch buffer.
+          auto offset = _requests[order[i]].offset;
+          auto end = offset;
+          vectors.clear();
+          do {
+            auto const &request = _requests[order[i]];
+            if (request.offset != end) {
+              vectors.push_back({gap.data(), request.offset - end});
+            }
+            if (request.size != 0) {
+              vectors.push_back({request.data, request.size});
+            }
+            end = request.offset + request.size;
+            ++i;
+          } while (
+            i < order.size()
+            && vectors.size() + 2 <= max_iovecs
+            && _requests[order[i]].offset >= end
+            && _requests[order[i]].offset - end <= _max_gap);
+          _read_vectors(fd, filename, vectors, offset);
+        }
+      }
+      catch (...) {
+        ::close(fd);
+        throw;
+      }
+      if (::close(fd) != 0) {
+        throw CloseException(filename);
+      }
+    }
+
+    static void _read_vectors(
+      int fd,
+      std::string const &filename,
+      std::vector<iovec> &vectors,
+      uint64_t offset)
+    {
+      auto *vector = vectors.data();
+      uint64_t count = vectors.size();
+      while (count != 0) {
+        auto ret = ::preadv(fd, vector, static_cast<int>(std::min(count, max_iovecs)), static_cast<off_t>(offset));
+        if (ret < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+          throw ReadException(filename);
+        }
+        if (ret == 0) {
+          throw ReadException(filename, "not enough remaining bytes at current offset");
+        }
+        offset += static_cast<uint64_t>(ret);
+        advance_iovecs(vector, count, static_cast<uint64_t>(ret));
+      }
+    }
+  };
+#endif
+
 }
 
 #endif
@@ -0,0 +1,73 @@
+// Regression tests for AsyncSerializer. Build and run with:
+//   g++ -std=c++20 -pthread -Iinclude tests/async_serializer.cpp && ./a.out
+
+#include <pickaxe.hpp>
+
+#include <cassert>
+#include <cstdio>
+#include <filesystem>
+
+namespace {
+
+  // Pushing exactly a multiple of the writer's batch size used to leave the
+  // last batch unpublished, so flush() never returned.
+  void test_flush_after_full_batches()
+  {
+    auto filename = (std::filesystem::temp_directory_path() / "pickaxe_async_serializer.bin").string();
+    pickaxe::DestructorExceptions exceptions;
+    {
+      pickaxe::AsyncSerializer serializer(exceptions, filename.c_str(), 4096, 256);
+      std::byte slice[256] = {};
+      for (int round = 1; round <= 2; ++round) {
+        for (int i = 0; i < 4096; ++i) {
+          serializer.push(slice, sizeof(slice));
+        }
+        serializer.flush();
+        assert(std::filesystem::file_size(filename) == round * 4096 * sizeof(slice));
+      }
+    }
+    assert(exceptions.is_empty());
+    std::filesystem::remove(filename);
+  }
+
+  // Once the writer thread has failed, pushing must throw instead of
+  // spinning on a queue that never drains.
+  void test_push_after_failure()
+  {
+    if (!std::filesystem::exists("/dev/full")) {
+      return;
+    }
+    pickaxe::DestructorExceptions exceptions;
+    {
+      pickaxe::AsyncSerializer serializer(exceptions, "/dev/full", 16, 256);
+      std::byte slice[256] = {};
+      bool failed = false;
+      try {
+        for (int i = 0; i < 100; ++i) {
+          serializer.push(slice, sizeof(slice));
+        }
+        serializer.flush();
+      }
+      catch (pickaxe::WriteException const &) {
+        failed = true;
+      }
+      assert(failed);
+      for (int i = 0; i < 100; ++i) {
+        try {
+          serializer.push(slice, sizeof(slice));
+          assert(false);
+        }
+        catch (pickaxe::WriteException const &) {
+        }
+      }
+    }
+  }
+
+}
+
+int main()
+{
+  test_flush_after_full_batches();
+  test_push_after_failure();
+  std::puts("ok");
+}
@@ -0,0 +1,134 @@
+// Round-trip and corruption tests for ColumnWriter and ColumnReader. Build
+// and run with:
+//   g++ -std=c++20 -pthread -Iinclude tests/column_table.cpp && ./a.out
+
+#include <pickaxe.hpp>
+
+#include <cassert>
+#include <cstddef>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace {
+
+  std::string const filename = (std::filesystem::temp_directory_path() / "pickaxe_column_table.bin").string();
+
+  struct Record {
+    uint8_t a;
+    double b;
+    uint16_t c;
+    uint64_t d;
+  };
+
+  std::vector<Record> make_records(
+    uint32_t count)
+  {
+    std::vector<Record> records;
+    for (uint32_t i = 0; i < count; ++i) {
+      records.push_back(Record{static_cast<uint8_t>(i), i * 0.5, static_cast<uint16_t>(i * 3), uint64_t{i} * 11});
+    }
+    return records;
+  }
+
+  uint64_t write_table(
+    std::vector<Record> const &records)
+  {
+    pickaxe::DestructorExceptions exceptions;
+    uint64_t table_offset;
+    {
+      pickaxe::Serializer serializer(exceptions, filename.c_str());
+      serializer.write(uint8_t{1});
+      pickaxe::ColumnWriter writer(serializer);
+      table_offset = writer.write(std::span<Record const>(records), &Record::a, &Record::b, &Record::c, &Record::d);
+    }
+    assert(exceptions.is_empty());
+    return table_offset;
+  }
+
+  void test_round_trip()
+  {
+    for (uint32_t count : {0, 1, 100000}) {
+      auto records = make_records(count);
+      auto table_offset = write_table(records);
+      pickaxe::DestructorExceptions exceptions;
+      pickaxe::Deserializer deserializer(exceptions, filename.c_str(), 4096);
+      pickaxe::ColumnReader reader(deserializer, table_offset);
+      assert(reader.get_column_count() == 4);
+      assert(reader.get_row_count() == count);
+      auto d = reader.read_column<uint64_t>(3);
+      std::vector<Record> out(count);
+      reader.read_column(0, std::span<Record>(out), &Record::a);
+      reader.read_column(1, std::span<Record>(out), &Record::b);
+      reader.read_column(2, std::span<Record>(out), &Record::c);
+      for (uint32_t i = 0; i < count; ++i) {
+        assert(d[i] == records[i].d);
+        assert(out[i].a == records[i].a && out[i].b == records[i].b && out[i].c == records[i].c && out[i].d == 0);
+      }
+    }
+  }
+
+  void overwrite(
+    uint64_t offset,
+    uint64_t value)
+  {
+    FILE *file = std::fopen(filename.c_str(), "r+b");
+    std::fseek(file, static_cast<long>(offset), SEEK_SET);
+    std::fwrite(&value, sizeof(value), 1, file);
+    std::fclose(file);
+  }
+
+  bool is_rejected(
+    uint64_t table_offset)
+  {
+    pickaxe::DestructorExceptions exceptions;
+    pickaxe::Deserializer deserializer(exceptions, filename.c_str(), 4096);
+    try {
+      pickaxe::ColumnReader reader(deserializer, table_offset);
+      (void)reader.read_column<uint64_t>(3);
+    }
+    catch (pickaxe::ReadException const &) {
+      return true;
+    }
+    return false;
+  }
+
+  void test_corrupt_table()
+  {
+    auto records = make_records(1000);
+    uint64_t descriptors_offset = sizeof(pickaxe::ColumnTableHeader);
+    struct Corruption {
+      uint64_t offset;
+      uint64_t value;
+    };
+    Corruption const corruptions[] = {
+      {offsetof(pickaxe::ColumnTableHeader, magic), 0},
+      {offsetof(pickaxe::ColumnTableHeader, column_count), uint64_t{1} << 60},
+      {offsetof(pickaxe::ColumnTableHeader, row_count), uint64_t{1} << 40},
+      {descriptors_offset + 3 * sizeof(pickaxe::ColumnDescriptor) + offsetof(pickaxe::ColumnDescriptor, offset), uint64_t{1} << 40},
+      {descriptors_offset + 3 * sizeof(pickaxe::ColumnDescriptor) + offsetof(pickaxe::ColumnDescriptor, element_size), 0},
+    };
+    for (auto corruption : corruptions) {
+      auto table_offset = write_table(records);
+      overwrite(table_offset + corruption.offset, corruption.value);
+      assert(is_rejected(table_offset));
+    }
+    // A table without columns reads nothing.
+    auto table_offset = write_table(records);
+    overwrite(table_offset + offsetof(pickaxe::ColumnTableHeader, column_count), 0);
+    pickaxe::DestructorExceptions exceptions;
+    pickaxe::Deserializer deserializer(exceptions, filename.c_str(), 4096);
+    pickaxe::ColumnReader reader(deserializer, table_offset);
+    assert(reader.get_column_count() == 0);
+  }
+
+}
+
+int main()
+{
+  test_round_trip();
+  test_corrupt_table();
+  std::filesystem::remove(filename);
+  std::puts("ok");
+}
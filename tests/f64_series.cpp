@@ -0,0 +1,81 @@
+// Round-trip and corruption tests for write_f64_series and
+// read_f64_series. Build and run with:
+//   g++ -std=c++20 -pthread -Iinclude tests/f64_series.cpp && ./a.out
+
+#include <pickaxe.hpp>
+
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace {
+
+  std::string const filename = (std::filesystem::temp_directory_path() / "pickaxe_f64_series.bin").string();
+
+  void write_series(
+    std::vector<double> const &values)
+  {
+    pickaxe::DestructorExceptions exceptions;
+    {
+      pickaxe::Serializer serializer(exceptions, filename.c_str());
+      pickaxe::write_f64_series(serializer, values);
+    }
+    assert(exceptions.is_empty());
+  }
+
+  std::vector<double> read_series()
+  {
+    pickaxe::DestructorExceptions exceptions;
+    pickaxe::Deserializer deserializer(exceptions, filename.c_str(), 4096);
+    return pickaxe::read_f64_series(deserializer);
+  }
+
+  void test_round_trip()
+  {
+    std::vector<double> values;
+    write_series(values);
+    assert(read_series().empty());
+    for (int i = 0; i < 100000; ++i) {
+      values.push_back(i % 100 < 50 ? 20.0 + i / 1000 : std::sin(i * 0.01));
+    }
+    values.push_back(-0.0);
+    values.push_back(1e300);
+    values.push_back(5e-324);
+    write_series(values);
+    auto result = read_series();
+    assert(result.size() == values.size());
+    for (size_t i = 0; i < values.size(); ++i) {
+      assert(std::bit_cast<uint64_t>(result[i]) == std::bit_cast<uint64_t>(values[i]));
+    }
+  }
+
+  // A corrupt count must be rejected before the vector is allocated.
+  void test_corrupt_count()
+  {
+    write_series({1.0, 2.0, 3.0});
+    uint64_t count = uint64_t{1} << 50;
+    FILE *file = std::fopen(filename.c_str(), "r+b");
+    std::fwrite(&count, sizeof(count), 1, file);
+    std::fclose(file);
+    bool rejected = false;
+    try {
+      (void)read_series();
+    }
+    catch (pickaxe::ReadException const &) {
+      rejected = true;
+    }
+    assert(rejected);
+  }
+
+}
+
+int main()
+{
+  test_round_trip();
+  test_corrupt_count();
+  std::filesystem::remove(filename);
+  std::puts("ok");
+}
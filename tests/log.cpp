@@ -0,0 +1,188 @@
+// Regression tests for LogSerializer and recover_log(). Build and run with:
+//   g++ -std=c++20 -pthread -Iinclude tests/log.cpp && ./a.out
+
+#include <pickaxe.hpp>
+
+#include <cassert>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace {
+
+  std::string const log_filename = (std::filesystem::temp_directory_path() / "pickaxe_log.bin").string();
+  std::string const copy_filename = (std::filesystem::temp_directory_path() / "pickaxe_log_copy.bin").string();
+
+  // Mostly small records, with one every few spanning several blocks.
+  std::vector<std::byte> make_record(
+    uint64_t index)
+  {
+    uint64_t size = index % 7 == 0 ? 40000 + index * 13 : index % 50;
+    return std::vector<std::byte>(size, static_cast<std::byte>(index));
+  }
+
+  void write_log(
+    char const *filename,
+    uint64_t record_count)
+  {
+    std::filesystem::remove(filename);
+    pickaxe::DestructorExceptions exceptions;
+    {
+      pickaxe::LogSerializer log(exceptions, filename);
+      for (uint64_t i = 0; i < record_count; ++i) {
+        auto record = make_record(i);
+        log.append(record.data(), record.size());
+      }
+      log.sync();
+    }
+    assert(exceptions.is_empty());
+  }
+
+  // Reads every record from the start, checking their contents.
+  pickaxe::LogTail scan_log(
+    char const *filename)
+  {
+    pickaxe::DestructorExceptions exceptions;
+    pickaxe::Deserializer deserializer(exceptions, filename, 4096);
+    pickaxe::LogReader reader(deserializer);
+    std::vector<std::byte> payload;
+    while (reader.read_record(payload)) {
+      auto record = make_record(reader.get_record_count() - 1);
+      assert(payload == record);
+    }
+    return pickaxe::LogTail{reader.get_valid_end(), reader.get_record_count()};
+  }
+
+  // Recovers a copy of the log and checks that it agrees with a full scan,
+  // and that appending resumes after the recovered records.
+  void check_recovery(
+    char const *filename)
+  {
+    auto expected = scan_log(filename);
+    pickaxe::DestructorExceptions exceptions;
+    assert(pickaxe::recover_log(exceptions, filename) == expected.record_count);
+    assert(std::filesystem::file_size(filename) == expected.valid_end);
+    {
+      pickaxe::LogSerializer log(exceptions, filename);
+      auto record = make_record(expected.record_count);
+      log.append_durable(record.data(), record.size());
+    }
+    assert(pickaxe::recover_log(exceptions, filename) == expected.record_count + 1);
+    assert(scan_log(filename).record_count == expected.record_count + 1);
+    assert(exceptions.is_empty());
+  }
+
+  void copy_log()
+  {
+    std::filesystem::copy_file(log_filename, copy_filename, std::filesystem::copy_options::overwrite_existing);
+  }
+
+  void flip_byte(
+    char const *filename,
+    uint64_t offset)
+  {
+    FILE *file = std::fopen(filename, "r+b");
+    std::fseek(file, static_cast<long>(offset), SEEK_SET);
+    int c = std::fgetc(file);
+    std::fseek(file, static_cast<long>(offset), SEEK_SET);
+    std::fputc(c ^ 0xff, file);
+    std::fclose(file);
+  }
+
+  void test_round_trip()
+  {
+    write_log(log_filename.c_str(), 1000);
+    auto tail = scan_log(log_filename.c_str());
+    assert(tail.record_count == 1000);
+    assert(tail.valid_end == std::filesystem::file_size(log_filename));
+    pickaxe::DestructorExceptions exceptions;
+    assert(pickaxe::recover_log(exceptions, log_filename.c_str()) == 1000);
+  }
+
+  // Records ending exactly at a block boundary, and a truncation there.
+  void test_block_boundaries()
+  {
+    std::filesystem::remove(log_filename);
+    pickaxe::DestructorExceptions exceptions;
+    uint64_t block_data = pickaxe::LogBlockHeader::block_size - sizeof(pickaxe::LogBlockHeader);
+    {
+      pickaxe::LogSerializer log(exceptions, log_filename.c_str());
+      std::vector<std::byte> record(block_data - sizeof(pickaxe::LogRecordHeader));
+      assert(log.append(record.data(), record.size()) == pickaxe::LogBlockHeader::block_size);
+      log.append(record.data(), 0);
+      log.sync();
+    }
+    assert(pickaxe::recover_log(exceptions, log_filename.c_str()) == 2);
+    std::filesystem::resize_file(log_filename, pickaxe::LogBlockHeader::block_size);
+    assert(pickaxe::recover_log(exceptions, log_filename.c_str()) == 1);
+    {
+      pickaxe::LogSerializer log(exceptions, log_filename.c_str());
+      log.append_durable("abc", 3);
+    }
+    assert(pickaxe::recover_log(exceptions, log_filename.c_str()) == 2);
+    assert(exceptions.is_empty());
+  }
+
+  void test_truncation()
+  {
+    write_log(log_filename.c_str(), 300);
+    auto size = std::filesystem::file_size(log_filename);
+    for (uint64_t cut = 1; cut < size; cut += 4999) {
+      copy_log();
+      std::filesystem::resize_file(copy_filename, size - cut);
+      check_recovery(copy_filename.c_str());
+    }
+  }
+
+  // A corrupt byte anywhere, including early in the log and inside block
+  // headers, must truncate the log at the record holding it.
+  void test_corruption()
+  {
+    write_log(log_filename.c_str(), 300);
+    auto size = std::filesystem::file_size(log_filename);
+    std::vector<uint64_t> offsets = {0, 20, 100, pickaxe::LogBlockHeader::block_size + 4, 2 * pickaxe::LogBlockHeader::block_size + 30, size / 2, size - 1};
+    for (uint64_t offset = 7; offset < size; offset += 7919) {
+      offsets.push_back(offset);
+    }
+    for (auto offset : offsets) {
+      copy_log();
+      flip_byte(copy_filename.c_str(), offset);
+      check_recovery(copy_filename.c_str());
+    }
+    // Inside the first record, well before the last block.
+    copy_log();
+    flip_byte(copy_filename.c_str(), 100);
+    pickaxe::DestructorExceptions exceptions;
+    assert(pickaxe::recover_log(exceptions, copy_filename.c_str()) == 0);
+  }
+
+  // A log with an invalid tail must be recovered before appending to it.
+  void test_append_to_torn_log()
+  {
+    write_log(log_filename.c_str(), 10);
+    std::filesystem::resize_file(log_filename, std::filesystem::file_size(log_filename) - 1);
+    pickaxe::DestructorExceptions exceptions;
+    bool failed = false;
+    try {
+      pickaxe::LogSerializer log(exceptions, log_filename.c_str());
+    }
+    catch (pickaxe::WriteException const &) {
+      failed = true;
+    }
+    assert(failed);
+  }
+
+}
+
+int main()
+{
+  test_round_trip();
+  test_block_boundaries();
+  test_truncation();
+  test_corruption();
+  test_append_to_torn_log();
+  std::filesystem::remove(log_filename);
+  std::filesystem::remove(copy_filename);
+  std::puts("ok");
+}
@@ -0,0 +1,140 @@
+// Round-trip and corruption tests for RecordWriter and RecordReader. Build
+// and run with:
+//   g++ -std=c++20 -pthread -Iinclude tests/record_index.cpp && ./a.out
+
+#include <pickaxe.hpp>
+
+#include <cassert>
+#include <cstddef>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+
+namespace {
+
+  std::string const filename = (std::filesystem::temp_directory_path() / "pickaxe_record_index.bin").string();
+
+  // Writes record_count records, record i holding i + 1 values, so that
+  // record sizes differ.
+  void write_records(
+    uint64_t record_count,
+    uint64_t chunk_record_count)
+  {
+    pickaxe::DestructorExceptions exceptions;
+    {
+      pickaxe::Serializer serializer(exceptions, filename.c_str());
+      pickaxe::RecordWriter writer = chunk_record_count == 0
+        ? pickaxe::RecordWriter(serializer)
+        : pickaxe::RecordWriter(serializer, chunk_record_count);
+      for (uint64_t i = 0; i < record_count; ++i) {
+        if (chunk_record_count == 0) {
+          writer.begin_record();
+        }
+        else {
+          writer.begin_record(i * 3);
+        }
+        for (uint64_t j = 0; j <= i; ++j) {
+          serializer.write(i);
+        }
+      }
+      writer.close();
+    }
+    assert(exceptions.is_empty());
+  }
+
+  void test_round_trip()
+  {
+    for (uint64_t chunk_record_count : {0, 1, 100}) {
+      write_records(1050, chunk_record_count);
+      pickaxe::DestructorExceptions exceptions;
+      pickaxe::Deserializer deserializer(exceptions, filename.c_str(), 4096);
+      pickaxe::RecordReader reader(deserializer);
+      assert(reader.get_record_count() == 1050);
+      for (uint64_t i = 0; i < 1050; ++i) {
+        assert(reader.get_record_size(i) == (i + 1) * sizeof(uint64_t));
+        reader.seek_record(i);
+        uint64_t value;
+        deserializer.read(value);
+        assert(value == i);
+        assert(reader.chunk_might_contain(chunk_record_count == 0 ? 0 : i / chunk_record_count, i * 3));
+      }
+    }
+    write_records(0, 0);
+    pickaxe::DestructorExceptions exceptions;
+    pickaxe::Deserializer deserializer(exceptions, filename.c_str(), 4096);
+    pickaxe::RecordReader reader(deserializer);
+    assert(reader.get_record_count() == 0);
+  }
+
+  // Overwrites one field of the footer at the end of the file.
+  void set_footer_field(
+    uint64_t field_offset,
+    uint64_t value)
+  {
+    auto footer_offset = std::filesystem::file_size(filename) - sizeof(pickaxe::RecordIndexFooter);
+    FILE *file = std::fopen(filename.c_str(), "r+b");
+    std::fseek(file, static_cast<long>(footer_offset + field_offset), SEEK_SET);
+    std::fwrite(&value, sizeof(value), 1, file);
+    std::fclose(file);
+  }
+
+  bool is_rejected()
+  {
+    pickaxe::DestructorExceptions exceptions;
+    pickaxe::Deserializer deserializer(exceptions, filename.c_str(), 4096);
+    try {
+      pickaxe::RecordReader reader(deserializer);
+    }
+    catch (pickaxe::ReadException const &) {
+      return true;
+    }
+    return false;
+  }
+
+  void test_corrupt_footer()
+  {
+    struct Corruption {
+      uint64_t field_offset;
+      uint64_t value;
+    };
+    Corruption const corruptions[] = {
+      {offsetof(pickaxe::RecordIndexFooter, magic), 0},
+      {offsetof(pickaxe::RecordIndexFooter, bit_width), 65},
+      // record_count * bit_width overflows to a small index.
+      {offsetof(pickaxe::RecordIndexFooter, record_count), uint64_t{1} << 60},
+      {offsetof(pickaxe::RecordIndexFooter, record_count), 1000000},
+      {offsetof(pickaxe::RecordIndexFooter, index_offset), uint64_t{1} << 40},
+      {offsetof(pickaxe::RecordIndexFooter, records_end), uint64_t{1} << 40},
+      {offsetof(pickaxe::RecordIndexFooter, base_offset), uint64_t{1} << 40},
+    };
+    for (auto corruption : corruptions) {
+      write_records(100, 0);
+      set_footer_field(corruption.field_offset, corruption.value);
+      assert(is_rejected());
+    }
+    Corruption const chunk_corruptions[] = {
+      // The magic of the footer version without Bloom filters.
+      {offsetof(pickaxe::RecordIndexFooter, magic), 0x3130584449525850},
+      {offsetof(pickaxe::RecordIndexFooter, bloom_block_count), 0},
+      {offsetof(pickaxe::RecordIndexFooter, bloom_block_count), uint64_t{1} << 32},
+      {offsetof(pickaxe::RecordIndexFooter, bloom_block_count), 1000},
+      {offsetof(pickaxe::RecordIndexFooter, bloom_offset), 0},
+      {offsetof(pickaxe::RecordIndexFooter, bloom_offset), uint64_t{1} << 40},
+      {offsetof(pickaxe::RecordIndexFooter, chunk_record_count), 1},
+    };
+    for (auto corruption : chunk_corruptions) {
+      write_records(100, 10);
+      set_footer_field(corruption.field_offset, corruption.value);
+      assert(is_rejected());
+    }
+  }
+
+}
+
+int main()
+{
+  test_round_trip();
+  test_corrupt_footer();
+  std::filesystem::remove(filename);
+  std::puts("ok");
+}
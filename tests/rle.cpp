@@ -0,0 +1,116 @@
+// Round-trip and corruption tests for write_rle and read_rle. Build and run
+// with:
+//   g++ -std=c++20 -pthread -Iinclude tests/rle.cpp && ./a.out
+
+#include <pickaxe.hpp>
+
+#include <cassert>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+  std::string const filename = (std::filesystem::temp_directory_path() / "pickaxe_rle.bin").string();
+
+  void write_bytes(
+    std::vector<uint8_t> const &values)
+  {
+    pickaxe::DestructorExceptions exceptions;
+    {
+      pickaxe::Serializer serializer(exceptions, filename.c_str());
+      pickaxe::write_rle(serializer, std::span<uint8_t const>(values));
+    }
+    assert(exceptions.is_empty());
+  }
+
+  std::vector<uint8_t> read_bytes()
+  {
+    pickaxe::DestructorExceptions exceptions;
+    pickaxe::Deserializer deserializer(exceptions, filename.c_str(), 4096);
+    return pickaxe::read_rle(deserializer);
+  }
+
+  bool is_rejected()
+  {
+    try {
+      (void)read_bytes();
+    }
+    catch (pickaxe::ReadException const &) {
+      return true;
+    }
+    return false;
+  }
+
+  void test_round_trip()
+  {
+    std::vector<uint8_t> values;
+    write_bytes(values);
+    assert(read_bytes().empty());
+    for (int i = 0; i < 100000; ++i) {
+      values.push_back(static_cast<uint8_t>(i / 1000 % 3 == 0 ? i : i / 1000));
+    }
+    write_bytes(values);
+    assert(read_bytes() == values);
+
+    bool flags[5000];
+    for (size_t i = 0; i < 5000; ++i) {
+      flags[i] = i % 700 < 300;
+    }
+    pickaxe::DestructorExceptions exceptions;
+    {
+      pickaxe::Serializer serializer(exceptions, filename.c_str());
+      pickaxe::write_rle(serializer, std::span<bool const>(flags));
+    }
+    bool result[5000];
+    {
+      pickaxe::Deserializer deserializer(exceptions, filename.c_str(), 4096);
+      pickaxe::read_rle(deserializer, std::span<bool>(result));
+    }
+    for (size_t i = 0; i < 5000; ++i) {
+      assert(result[i] == flags[i]);
+    }
+    assert(exceptions.is_empty());
+  }
+
+  // Rewrites the stream with the given count and (value, run) pairs.
+  void write_raw(
+    uint64_t count,
+    std::vector<std::pair<uint8_t, uint64_t>> const &runs)
+  {
+    pickaxe::DestructorExceptions exceptions;
+    {
+      pickaxe::Serializer serializer(exceptions, filename.c_str());
+      serializer.write_varint(count);
+      for (auto [value, run] : runs) {
+        serializer.write(value);
+        serializer.write_varint(run);
+      }
+    }
+    assert(exceptions.is_empty());
+  }
+
+  void test_corrupt_stream()
+  {
+    // A huge count with too few runs to back it.
+    write_raw(uint64_t{1} << 50, {{1, 10}});
+    assert(is_rejected());
+    write_raw(10, {{1, 0}});
+    assert(is_rejected());
+    write_raw(10, {{1, 11}});
+    assert(is_rejected());
+    write_raw(10, {{1, 5}});
+    assert(is_rejected());
+  }
+
+}
+
+int main()
+{
+  test_round_trip();
+  test_corrupt_stream();
+  std::filesystem::remove(filename);
+  std::puts("ok");
+}
@@ -0,0 +1,63 @@
+// Regression tests for Serializer. Build and run with:
+//   g++ -std=c++20 -pthread -Iinclude tests/serializer.cpp && ./a.out
+
+#include <pickaxe.hpp>
+
+#include <cassert>
+#include <cstdio>
+#include <filesystem>
+
+namespace {
+
+  // Closing used to truncate every file, and preallocating to fail, on
+  // anything but a regular file.
+  void test_close_device()
+  {
+    if (!std::filesystem::exists("/dev/null")) {
+      return;
+    }
+    pickaxe::DestructorExceptions exceptions;
+    {
+      pickaxe::Serializer serializer(exceptions, "/dev/null");
+      uint64_t value = 42;
+      serializer.write(value);
+      serializer.skip(4096);
+    }
+    {
+      pickaxe::Serializer serializer(exceptions, "/dev/null", pickaxe::SerializerOptions{.expected_size = 4096});
+      uint64_t value = 42;
+      serializer.write(value);
+    }
+    assert(exceptions.is_empty());
+  }
+
+  // A skipped or preallocated tail is cut to the end of what was written.
+  void test_resize_tail()
+  {
+    auto filename = (std::filesystem::temp_directory_path() / "pickaxe_serializer.bin").string();
+    pickaxe::DestructorExceptions exceptions;
+    {
+      pickaxe::Serializer serializer(exceptions, filename.c_str());
+      uint64_t value = 42;
+      serializer.write(value);
+      serializer.skip(1000);
+    }
+    assert(std::filesystem::file_size(filename) == 1008);
+    {
+      pickaxe::Serializer serializer(exceptions, filename.c_str(), pickaxe::SerializerOptions{.expected_size = 1 << 20});
+      uint64_t value = 42;
+      serializer.write(value);
+    }
+    assert(std::filesystem::file_size(filename) == 8);
+    assert(exceptions.is_empty());
+    std::filesystem::remove(filename);
+  }
+
+}
+
+int main()
+{
+  test_close_device();
+  test_resize_tail();
+  std::puts("ok");
+}